@@ -0,0 +1,21 @@
+#ifndef CONFIGBENCH_H
+#define CONFIGBENCH_H
+
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <chrono>
+#include <cstdlib>
+#include <cstdio>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <algorithm>
+#include <fstream>
+#include <new>
+#include <sys/stat.h>
+#include "config.h"
+
+#endif
@@ -0,0 +1,8 @@
+#ifndef CONFIGCOMPILE_H
+#define CONFIGCOMPILE_H
+
+#include <iostream>
+#include <string>
+#include "config.h"
+
+#endif
@@ -0,0 +1,12 @@
+#ifndef CONFIGTEST_H
+#define CONFIGTEST_H
+
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <sstream>
+#include <string>
+#include <unistd.h>
+#include "config.h"
+
+#endif
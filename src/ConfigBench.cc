@@ -0,0 +1,376 @@
+#include "ConfigBench.h"
+
+// Benchmark suite of the config subsystem: parsing (config::append,
+// config_table, config_pool, appendparallel), config_entry::reinit, the
+// conversion operators, lookup latency and concurrent lookups, on
+// synthetic config files.
+// Usage: ./ConfigBench [<maxlines> [<nlookups>]]  (default: 10000000 lines,
+// 1000000 lookups)
+// Results are also written into results/<TAG>/configbench.csv, with TAG
+// taken from PREFIX_TAG or TAG in the environment ("bench" if unset).
+
+
+//////////////////// Allocation counting ///////////////////////////////
+
+
+#ifndef __CONFIG_ALLOC_PROFILING
+static std::atomic<unsigned long long> nallocations(0);
+
+
+void* operator new(std::size_t size)
+{
+    ++nallocations;
+    void *result=std::malloc(size ? size : 1);
+    if ( result==0 ) throw std::bad_alloc();
+    return result;
+}
+
+
+void operator delete(void *p) noexcept
+{
+    std::free(p);
+}
+
+
+static unsigned long long allocationcount()
+{
+    return nallocations;
+}
+#else
+// With allocation profiling config counts the allocations (malloc too):
+static unsigned long long allocationcount()
+{
+    return alloc_profile::allocations();
+}
+#endif
+
+
+//////////////////// Results ///////////////////////////////////////////
+
+
+// Machine-readable results (benchmark, variant, lines, metric, value):
+static std::ostringstream results;
+
+
+static void record(const std::string &benchmark, const std::string &variant, const unsigned long long lines, const std::string &metric, const double value)
+{
+    results<<benchmark<<","<<variant<<","<<lines<<","<<metric<<","<<value<<"\n";
+}
+
+
+static void writeresults()
+{
+    const std::string filename=getresultsdir("bench")+"/configbench.csv";
+    std::ofstream file(filename.c_str());
+    if ( !(file<<"benchmark,variant,lines,metric,value\n"<<results.str()) )
+    {
+	std::cerr<<"[ConfigBench] Could not write "<<filename<<" !"<<std::endl;
+	return;
+    }
+    std::cout<<"Results written into "<<filename<<std::endl;
+}
+
+
+//////////////////// Synthetic config files ////////////////////////////
+
+
+// Synthetic config file content with n lines: integers, reals,
+// inf/nan, bools, strings and lists, with the given fraction of
+// comment and empty lines. Tokens are key_<i>:
+static std::string mkconfigbuffer(const unsigned int n, const double commentfraction=0.0, const unsigned int seed=12345)
+{
+    std::ostringstream oss;
+    std::srand(seed);
+    unsigned int key=0;
+    for ( unsigned int i=0 ; i<n ; ++i )
+    {
+	const double r=(double)std::rand()/RAND_MAX;
+	if ( r<commentfraction*0.8 ) { oss<<"# comment line "<<i<<", describing the next parameters\n"; continue; }
+	if ( r<commentfraction ) { oss<<"\n"; continue; }
+	oss<<"key_"<<key<<(key%3==0 ? " = " : "\t");
+	switch ( key%10 )
+	{
+	    case 0: case 1: case 2: oss<<std::rand(); break;
+	    case 3: case 4: case 5: oss<<(double)std::rand()/RAND_MAX*1.0e3; break;
+	    case 6: oss<<(key%20<10 ? "inf" : (key%20<15 ? "-inf" : "nan")); break;
+	    case 7: oss<<(key%20<10 ? "true" : "false"); break;
+	    case 8: oss<<"string_value_"<<key; break;
+	    case 9: oss<<"["<<key%7<<", "<<key%11<<", "<<key%13<<".5]"; break;
+	}
+	oss<<"\n";
+	++key;
+    }
+    return oss.str();
+}
+
+
+// Number of generated numeric values which did not convert (the 
+// benchmarks would then time the error path):
+static unsigned int badvalues=0;
+
+
+static void checkvalue(const config_entry &entry, const std::string &what)
+{
+    const config_entry::entry_type type=entry.type();
+    if ( entry.success() && type!=config_entry::string_type && type!=config_entry::list_type ) return;
+    if ( badvalues++==0 ) std::cerr<<"[ConfigBench] Numeric value \""<<entry.string()<<"\" ("<<what<<") does not convert!"<<std::endl;
+}
+
+
+// Check that the numeric values (integers, reals, inf/nan, bools) of a 
+// parsed synthetic config file convert:
+static void checkconfigvalues(const config_table &conf, const std::string &variant)
+{
+    char token[32];
+    for ( unsigned int key=0 ; ; ++key )
+    {
+	std::snprintf(token, sizeof(token), "key_%u", key);
+	const config_entry *entry=conf.find(token);
+	if ( entry==0 ) break;
+	if ( key%10<8 ) checkvalue(*entry, token+variant);
+    }
+}
+
+
+static double elapsed_ns(const std::chrono::steady_clock::time_point &start)
+{
+    return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now()-start).count();
+}
+
+
+// Random lookup keys of a synthetic config:
+static std::vector<std::string> mkkeys(const unsigned int nkeys, const unsigned int n, const unsigned int seed)
+{
+    std::vector<std::string> keys(n);
+    std::srand(seed);
+    for ( unsigned int i=0 ; i<n ; ++i )
+    {
+	std::ostringstream oss;
+	oss<<"key_"<<(std::rand()%nkeys);
+	keys[i]=oss.str();
+    }
+    return keys;
+}
+
+
+//////////////////// Parsing ///////////////////////////////////////////
+
+
+// Parse a buffer into a config container C, and report throughput and
+// allocations per line:
+template <class C, class F>
+static void bench_parse_one(const std::string &variant, const std::string &buffer, const unsigned int nlines, F parse)
+{
+    C conf;
+    const unsigned long long allocations=allocationcount();
+    const std::chrono::steady_clock::time_point start=std::chrono::steady_clock::now();
+    parse(conf);
+    const double seconds=elapsed_ns(start)*1.0e-9;
+    const double allocsperline=(double)(allocationcount()-allocations)/nlines;
+    std::cout<<"parse  "<<variant<<"  lines="<<nlines<<"  "<<nlines/seconds*1.0e-6<<" Mlines/s  "<<buffer.length()/seconds/1048576.0<<" MB/s  "<<allocsperline<<" allocations/line"<<std::endl;
+    record("parse", variant, nlines, "lines_per_s", nlines/seconds);
+    record("parse", variant, nlines, "MB_per_s", buffer.length()/seconds/1048576.0);
+    record("parse", variant, nlines, "allocations_per_line", allocsperline);
+}
+
+
+static void bench_parse(const unsigned int nlines, const double commentfraction)
+{
+    const std::string buffer=mkconfigbuffer(nlines, commentfraction);
+    std::ostringstream variant;
+    variant<<"/comments="<<commentfraction;
+    const char *data=buffer.data();
+    const std::size_t length=buffer.length();
+    config_table checked;
+    checked.append(data, length);
+    checkconfigvalues(checked, variant.str());
+    // Baseline: the classic getline/istringstream parse into a map:
+    bench_parse_one< std::map<std::string, std::string> >("getline_istringstream"+variant.str(), buffer, nlines, [&](std::map<std::string, std::string> &c) {
+	std::istringstream iss(buffer);
+	std::string line, token, value;
+	while ( std::getline(iss, line) )
+	{
+	    std::istringstream linestream(line);
+	    if ( !(linestream>>token) || token[0]=='#' ) continue;
+	    if ( linestream>>value && value=="=" ) linestream>>value;
+	    c[token]=value;
+	}
+    });
+    bench_parse_one<config>("config"+variant.str(), buffer, nlines, [&](config &c) { c.append(data, length); });
+    bench_parse_one<config>("config_istream"+variant.str(), buffer, nlines, [&](config &c) { std::istringstream iss(buffer); c.append(iss); });
+    bench_parse_one<config>("config_parallel"+variant.str(), buffer, nlines, [&](config &c) { c.appendparallel(data, length, 0); });
+    bench_parse_one<config_table>("config_table"+variant.str(), buffer, nlines, [&](config_table &c) { c.append(data, length); });
+    bench_parse_one<config_table>("config_table_parallel"+variant.str(), buffer, nlines, [&](config_table &c) { c.appendparallel(data, length, 0); });
+    bench_parse_one<config_pool>("config_pool"+variant.str(), buffer, nlines, [&](config_pool &c) { c.append(data, length); });
+}
+
+
+//////////////////// config_entry //////////////////////////////////////
+
+
+// Cost of config_entry::reinit and of the conversion operators:
+static void bench_entry(const unsigned int n)
+{
+    const char *values[]={ "12345", "-3.25e2", "inf", "nan", "true", "string_value", "[1, 2, 3]" };
+    const unsigned int nvalues=sizeof(values)/sizeof(values[0]);
+    std::vector<std::string> strings(nvalues);
+    for ( unsigned int v=0 ; v<nvalues ; ++v ) strings[v]=values[v];
+    config_entry entry;
+    for ( unsigned int v=0 ; v<nvalues ; ++v )
+    {
+	const std::chrono::steady_clock::time_point start=std::chrono::steady_clock::now();
+	for ( unsigned int i=0 ; i<n ; ++i ) entry.reinit(strings[v]);
+	const double t=elapsed_ns(start)/n;
+	std::cout<<"reinit  \""<<values[v]<<"\"  "<<t<<" ns"<<std::endl;
+	record("reinit", values[v], 0, "ns", t);
+	// All but the string and the list are numbers:
+	if ( v<5 ) checkvalue(entry, "reinit");
+    }
+
+    // Conversions of exactly representable values (no warnings):
+    config_entry integer("12345"), real("-3.25e2"), boolean("true");
+    double sum=0.0;
+    std::chrono::steady_clock::time_point start=std::chrono::steady_clock::now();
+    for ( unsigned int i=0 ; i<n ; ++i ) sum+=(double)real;
+    double t=elapsed_ns(start)/n;
+    std::cout<<"convert  double  "<<t<<" ns"<<std::endl;
+    record("convert", "double", 0, "ns", t);
+    start=std::chrono::steady_clock::now();
+    for ( unsigned int i=0 ; i<n ; ++i ) sum+=(int)integer;
+    t=elapsed_ns(start)/n;
+    std::cout<<"convert  int  "<<t<<" ns"<<std::endl;
+    record("convert", "int", 0, "ns", t);
+    start=std::chrono::steady_clock::now();
+    for ( unsigned int i=0 ; i<n ; ++i ) sum+=(bool)boolean;
+    t=elapsed_ns(start)/n;
+    std::cout<<"convert  bool  "<<t<<" ns  (checksum "<<sum<<")"<<std::endl;
+    record("convert", "bool", 0, "ns", t);
+}
+
+
+//////////////////// Lookup latency ////////////////////////////////////
+
+
+// Lookup latency percentiles. Lookups are timed in batches, so that
+// the clock overhead is small against the measured time:
+template <class F>
+static void bench_lookup_one(const std::string &variant, const unsigned int nkeys, const std::vector<std::string> &keys, F lookup)
+{
+    const unsigned int batch=16;
+    std::vector<double> latencies;
+    latencies.reserve(keys.size()/batch);
+    double sum=0.0;
+    for ( std::size_t i=0 ; i+batch<=keys.size() ; i+=batch )
+    {
+	const std::chrono::steady_clock::time_point start=std::chrono::steady_clock::now();
+	for ( unsigned int j=0 ; j<batch ; ++j ) sum+=lookup(keys[i+j].c_str());
+	latencies.push_back(elapsed_ns(start)/batch);
+    }
+    if ( latencies.empty() ) return;
+    std::sort(latencies.begin(), latencies.end());
+    const double quantiles[]={ 0.5, 0.9, 0.99, 0.999 };
+    const char *names[]={ "p50_ns", "p90_ns", "p99_ns", "p99.9_ns" };
+    std::cout<<"lookup  "<<variant<<"  keys="<<nkeys;
+    for ( unsigned int q=0 ; q<4 ; ++q )
+    {
+	const double value=latencies[(std::size_t)(quantiles[q]*(latencies.size()-1))];
+	std::cout<<"  "<<names[q]<<"="<<value;
+	record("lookup", variant, nkeys, names[q], value);
+    }
+    std::cout<<"  (checksum "<<sum<<")"<<std::endl;
+}
+
+
+static void bench_lookup(const unsigned int nkeys, const unsigned int nlookups)
+{
+    const std::string buffer=mkconfigbuffer(nkeys);
+    config conf;
+    conf.append(buffer.data(), buffer.length());
+    const config &cconf=conf;
+    config_table table;
+    table.append(buffer.data(), buffer.length());
+    config_pool pool;
+    pool.append(buffer.data(), buffer.length());
+    const std::vector<std::string> keys=mkkeys(nkeys, nlookups, 54321);
+    // key_3 holds a real (see mkconfigbuffer):
+    config_key<double> key(conf, "key_3");
+
+    bench_lookup_one("config", nkeys, keys, [&](const char *k) { return (double)cconf.find(k)->ldbl(); });
+    bench_lookup_one("getconfig(config)", nkeys, keys, [&](const char *k) { return (double)getconfig(cconf, k).ldbl(); });
+    bench_lookup_one("getconfig(config_table)", nkeys, keys, [&](const char *k) { return (double)getconfig(table, k).ldbl(); });
+    bench_lookup_one("getconfig(config_pool)", nkeys, keys, [&](const char *k) { return (double)getconfig(pool, k).ldbl(); });
+    bench_lookup_one("config_key<double>", nkeys, keys, [&](const char*) { return *key; });
+}
+
+
+//////////////////// Concurrent lookups ////////////////////////////////
+
+
+// Run nthreads threads doing nlookups lookups each, return the
+// aggregate throughput in lookups/s:
+template <class F>
+static double run_threads(const unsigned int nthreads, const unsigned int nlookups, const std::vector< std::vector<std::string> > &keys, F lookup)
+{
+    std::vector<double> sums(nthreads, 0.0);
+    std::vector<std::thread> threads;
+    const std::chrono::steady_clock::time_point start=std::chrono::steady_clock::now();
+    for ( unsigned int t=0 ; t<nthreads ; ++t )
+    {
+	threads.push_back(std::thread([&, t]() {
+	    double sum=0.0;
+	    for ( unsigned int i=0 ; i<nlookups ; ++i ) sum+=lookup(keys[t][i].c_str());
+	    sums[t]=sum;
+	}));
+    }
+    for ( unsigned int t=0 ; t<nthreads ; ++t ) threads[t].join();
+    return nthreads*(double)nlookups/(elapsed_ns(start)*1.0e-9);
+}
+
+
+// Concurrent read throughput: mutex protected config (the old way of
+// sharing a config between threads), lock-free const config, and
+// frozen config_table:
+static void bench_contention(const unsigned int nkeys, const unsigned int nlookups)
+{
+    const std::string buffer=mkconfigbuffer(nkeys);
+    config conf;
+    conf.append(buffer.data(), buffer.length());
+    const config &cconf=conf;
+    std::shared_ptr<const config_table> frozen=freezeconfig(conf);
+    std::mutex mutex;
+    std::vector< std::vector<std::string> > keys;
+    for ( unsigned int t=0 ; t<64 ; ++t ) keys.push_back(mkkeys(nkeys, nlookups, t+1));
+
+    for ( unsigned int nthreads=1 ; nthreads<=64 ; nthreads*=2 )
+    {
+	const double r_mutex=run_threads(nthreads, nlookups, keys, [&](const char *key) { std::lock_guard<std::mutex> lock(mutex); return (double)cconf.find(key)->ldbl(); });
+	const double r_const=run_threads(nthreads, nlookups, keys, [&](const char *key) { return (double)cconf.find(key)->ldbl(); });
+	const double r_frozen=run_threads(nthreads, nlookups, keys, [&](const char *key) { return (double)frozen->find(key)->ldbl(); });
+	std::cout<<"threads="<<nthreads<<"  keys="<<nkeys<<"  Mlookups/s  mutex+config: "<<r_mutex*1.0e-6<<"  const config: "<<r_const*1.0e-6<<"  frozen config_table: "<<r_frozen*1.0e-6<<std::endl;
+	std::ostringstream variant;
+	variant<<"/threads="<<nthreads;
+	record("contention", "mutex+config"+variant.str(), nkeys, "lookups_per_s", r_mutex);
+	record("contention", "const_config"+variant.str(), nkeys, "lookups_per_s", r_const);
+	record("contention", "frozen_config_table"+variant.str(), nkeys, "lookups_per_s", r_frozen);
+    }
+}
+
+
+int main(int argc, const char *argv[])
+{
+    const unsigned int maxlines=(argc>1 ? std::atoi(argv[1]) : 10000000);
+    const unsigned int nlookups=(argc>2 ? std::atoi(argv[2]) : 1000000);
+    summaryinfo::write_logfile(false);
+
+    for ( unsigned int nlines=1000 ; nlines<=maxlines && nlines>0 ; nlines*=10 )
+    {
+	bench_parse(nlines, 0.0);
+	bench_parse(nlines, 0.3);
+    }
+    bench_entry(1000000);
+    for ( unsigned int nkeys=100 ; nkeys<=maxlines && nkeys>0 ; nkeys*=100 ) bench_lookup(nkeys, nlookups);
+    bench_contention(10000, nlookups/10);
+    writeresults();
+    if ( badvalues>0 ) std::cerr<<"[ConfigBench] "<<badvalues<<" numeric values did not convert, the results time the error path!"<<std::endl;
+    return (badvalues==0 ? 0 : 1);
+}
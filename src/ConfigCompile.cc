@@ -0,0 +1,23 @@
+#include "ConfigCompile.h"
+
+// Compiles config files into binary images, which config::append 
+// then loads instead of parsing the text.
+// Usage: ./ConfigCompile <configfile> [<configfile> ...]
+
+int main(int argc, const char *argv[])
+{
+    if ( argc<2 )
+    {
+	std::cerr << "Usage: ./ConfigCompile <configfile> [<configfile> ...]" << std::endl;
+	exit(1);
+    }
+
+    summaryinfo::write_logfile(false);
+    int result=0;
+    for ( int i=1 ; i<argc ; ++i )
+    {
+	if ( !compileconfig(argv[i]) ) result=1;
+	else std::cout << "Compiled " << argv[i] << " into " << config_image::imagename(argv[i]) << std::endl;
+    }
+    return result;
+}
@@ -0,0 +1,140 @@
+#include "ConfigTest.h"
+
+// Regression tests of the config classes. Returns 1 if any check fails.
+// Usage: ./ConfigTest
+
+static int failures=0;
+
+#define CHECK(condition) \
+    if ( !(condition) ) { std::cerr << "FAILED: " << #condition << " (" << __FILE__ << ":" << __LINE__ << ")" << std::endl; ++failures; }
+
+
+// Spans must keep their storage alive after the (temporary) entry and 
+// config are gone:
+static void testspans()
+{
+    config_span<double> edges(0, 0);
+    config_span<long long> counts(0, 0);
+    config_span<double> scalar(0, 0);
+    config_span<long long> integer(0, 0);
+    {
+	std::istringstream text("edges [0, 10, 20.5, 50]\ncounts [1 2 3]\nscalar 2.5\ninteger 7\n");
+	config conf;
+	conf.append(text);
+	edges=getconfig(conf, "edges").doubles();
+	counts=getconfig(conf, "counts").integers();
+	scalar=getconfig(conf, "scalar").doubles();
+	integer=getconfig(conf, "integer").integers();
+    }
+    CHECK( edges.size()==4 && edges[0]==0 && edges[2]==20.5 && edges[3]==50 );
+    CHECK( counts.size()==3 && counts[0]==1 && counts[2]==3 );
+    CHECK( scalar.size()==1 && scalar[0]==2.5 );
+    CHECK( integer.size()==1 && integer[0]==7 );
+
+    std::istringstream text("edges [1, 2, 3]\n");
+    config_span<double> streamed=getconfig(text, "edges").doubles();
+    CHECK( streamed.size()==3 && streamed[0]==1 && streamed[2]==3 );
+}
+
+
+// Schema fields of every kind of type, with each bad value reported 
+// once:
+struct schemafields
+{
+    double real;
+    int integer;
+    unsigned int count;
+    bool flag;
+    char letter;
+    std::string name;
+};
+
+static void testschema()
+{
+    static const config_schema<schemafields> schema=config_schema<schemafields>()
+	.field("real", &schemafields::real, 1.0, 0.0, 10.0)
+	.field("integer", &schemafields::integer)
+	.field("count", &schemafields::count, 5u)
+	.field("flag", &schemafields::flag, false)
+	.field("letter", &schemafields::letter)
+	.field("name", &schemafields::name, std::string("default"));
+    schemafields s;
+    std::istringstream good("real 2.5\ninteger -3\nflag true\nletter x\n");
+    config conf;
+    conf.append(good);
+    CHECK( schema.fill(s, conf) );
+    CHECK( s.real==2.5 && s.integer==-3 && s.count==5 && s.flag && s.letter=='x' && s.name=="default" );
+
+    std::istringstream bad("real 20\ninteger 1.5\ncount -1\nflag 2\nletter xy\n");
+    config badconf;
+    badconf.append(bad);
+    std::ostringstream errors;
+    std::streambuf *cerrbuf=std::cerr.rdbuf(errors.rdbuf());
+    const bool filled=schema.fill(s, badconf);
+    std::cerr.rdbuf(cerrbuf);
+    CHECK( !filled );
+    // One report (of two lines) for each of the five bad fields:
+    const std::string report=errors.str();
+    CHECK( std::count(report.begin(), report.end(), '\n')==10 );
+}
+
+
+// A corrupt config image must be rejected as a whole, so that the text 
+// file is read instead:
+static void testimage()
+{
+    std::ostringstream name;
+    name << "/tmp/ConfigTest_" << ::getpid() << ".conf";
+    const std::string filename=name.str(), image=config_image::imagename(filename);
+    {
+	std::ofstream file(filename.c_str());
+	file << "alpha 1\nbeta 2.5\ngamma [1 2 3]\n";
+    }
+    CHECK( compileconfig(filename) );
+    {
+	config conf(filename);
+	CHECK( getconfig<int>(conf, "alpha")==1 && getconfig<double>(conf, "beta")==2.5 && getconfig(conf, "gamma").doubles().size()==3 );
+    }
+    {
+	// Corrupt the last character of the string table (the value of 
+	// gamma):
+	std::fstream file(image.c_str(), std::ios::in|std::ios::out|std::ios::binary);
+	file.seekp(-1, std::ios::end);
+	file.put('X');
+    }
+    std::ostringstream errors;
+    std::streambuf *cerrbuf=std::cerr.rdbuf(errors.rdbuf());
+    config conf(filename);
+    std::cerr.rdbuf(cerrbuf);
+    CHECK( errors.str().find("Corrupt config image")!=std::string::npos );
+    CHECK( getconfig<int>(conf, "alpha")==1 && getconfig(conf, "gamma").string()=="[1 2 3]" );
+    ::unlink(filename.c_str());
+    ::unlink(image.c_str());
+}
+
+
+// Numbers are read as by operator>> in the "C" locale:
+static void testnumbers()
+{
+    CHECK( config_entry("2.5").type()==config_entry::real_type && config_entry("2.5").ldbl()==2.5 );
+    CHECK( config_entry("0x10").success() && config_entry("0x10").ldbl()==0 );
+    CHECK( config_entry("inf").success() && std::isinf(config_entry("inf").ldbl()) && config_entry("inf").ldbl()>0 );
+    CHECK( config_entry("-inf").success() && std::isinf(config_entry("-inf").ldbl()) && config_entry("-inf").ldbl()<0 );
+    CHECK( config_entry("nan").success() && std::isnan(config_entry("nan").ldbl()) );
+    CHECK( config_entry("1e999").success() && config_entry("1e999").type()==config_entry::real_type && std::isinf(config_entry("1e999").ldbl()) );
+    CHECK( !config_entry("infinity").success() && !config_entry("inf5").success() );
+    const config_span<double> edges=config_entry("[0, 10, inf]").doubles();
+    CHECK( edges.size()==3 && std::isinf(edges[2]) );
+}
+
+
+int main()
+{
+    summaryinfo::write_logfile(false);
+    testnumbers();
+    testspans();
+    testschema();
+    testimage();
+    if ( failures==0 ) std::cout << "All config tests passed." << std::endl;
+    return failures==0 ? 0 : 1;
+}
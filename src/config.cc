@@ -10,416 +10,4185 @@
 
 
 config_entry::config_entry()
- : string_(), longdouble_(0.0), success_(false)
+ : string_(), type_(string_type), integer_(0), double_(0.0), int_(0), uint_(0), bool_(false), exact_(0), success_(false), list_(), external_(0), externallength_(0)
 {
 }
 
 
 config_entry::config_entry(const config_entry &other)
- : string_(other.string_), longdouble_(other.longdouble_), success_(other.success_)
+ : string_(other.external_ ? std::string(other.external_, other.externallength_) : other.string_), type_(other.type_), integer_(other.integer_), double_(other.double_), int_(other.int_), uint_(other.uint_), bool_(other.bool_), exact_(other.exact_), success_(other.success_), list_(other.list_), external_(0), externallength_(0)
 {
 }
 
 
+// Truncate a double to 64 bit integer, saturating (0 for nan):
+static long long saturatedinteger(const double d)
+{
+    if ( d!=d ) return 0;
+    else if ( d>=9.2233720368547758e18 ) return LLONG_MAX;
+    else if ( d<=-9.2233720368547758e18 ) return LLONG_MIN;
+    else return (long long)d;
+}
+
+
+// The "C" locale, so that numbers are read the same in any locale of 
+// the program:
+static locale_t clocale()
+{
+    static const locale_t c=::newlocale(LC_ALL_MASK, "C", (locale_t)0);
+    return c;
+}
+
+
+// Read a decimal number at the beginning of a string, as operator>> 
+// does: a hexadecimal number is read up to its leading 0, and numbers 
+// out of the double range are read as +-inf. A spelled out infinity is 
+// read only if allowed, nan never. Returns the end of the number (the 
+// beginning, if there is none):
+static const char* readdouble(const char *begin, double &d, const bool infinity)
+{
+    char *end=0;
+    d=::strtod_l(begin, &end, clocale());
+    if ( end==begin ) return begin;
+    const char *p=begin;
+    if ( *p=='+' || *p=='-' ) ++p;
+    if ( p[0]=='0' && (p[1]=='x' || p[1]=='X') )
+    {
+	d=0.0;
+	return p+1;
+    }
+    if ( !::isdigit((unsigned char)*p) && *p!='.' && (std::isnan(d) || !infinity) )
+    {
+	d=0.0;
+	return begin;
+    }
+    return end;
+}
+
+
 config_entry& config_entry::reinit(const std::string &str)
 {
-    string_=str;
-    std::istringstream iss(string_);
-    long double zero=0.0;
-    long double minusone=-1.0;
-    if ( !(iss>>longdouble_) )
+    return reinit(str.data(), str.length());
+}
+
+
+config_entry& config_entry::reinit(const char *str, const std::size_t length)
+{
+    string_.assign(str, length);
+    external_=0;
+    externallength_=0;
+    return classify(string_.c_str(), string_.length());
+}
+
+
+config_entry& config_entry::reinitexternal(const char *str, const std::size_t length)
+{
+    string_.clear();
+    external_=str;
+    externallength_=length;
+    return classify(str, length);
+}
+
+
+config_entry& config_entry::classify(const char *begin, const std::size_t length)
+{
+    type_=string_type;
+    integer_=0;
+    double_=0.0;
+    success_=false;
+    list_.reset();
+    char *end=0;
+    if ( length>=2 && begin[0]=='[' && begin[length-1]==']' )
+    {
+	type_=list_type;
+	list_=std::make_shared<const config_list>(begin, length);
+    }
+    else if ( (length==4 && ::memcmp(begin, "true", 4)==0) || (length==5 && ::memcmp(begin, "false", 5)==0) )
+    {
+	type_=bool_type;
+	integer_=(length==4 ? 1 : 0);
+	double_=(double)integer_;
+	success_=true;
+    }
+    else if ( (length==3 && ::memcmp(begin, "inf", 3)==0) || (length==4 && ::memcmp(begin, "-inf", 4)==0) || (length==3 && ::memcmp(begin, "nan", 3)==0) )
+    {
+	type_=real_type;
+	double_=(begin[0]=='n' ? std::numeric_limits<double>::quiet_NaN() : (begin[0]=='-' ? -1.0 : 1.0)*std::numeric_limits<double>::infinity());
+	integer_=saturatedinteger(double_);
+	success_=true;
+    }
+    else if ( length!=0 && !::isspace((unsigned char)begin[0]) )
+    {
+	errno=0;
+	const long long i=::strtoll(begin, &end, 10);
+	if ( end==begin+length && errno==0 )
+	{
+	    type_=integer_type;
+	    integer_=i;
+	    double_=(double)i;
+	    success_=true;
+	}
+	else
+	{
+	    // As operator>>, accept a leading number also if followed by 
+	    // other characters (the entry then remains a string):
+	    double d=0.0;
+	    const char *numberend=readdouble(begin, d, false);
+	    if ( numberend!=begin )
+	    {
+		type_=(numberend==begin+length ? real_type : string_type);
+		double_=d;
+		success_=true;
+		integer_=saturatedinteger(d);
+	    }
+	}
+    }
+    const bool integral=success_ && (type_==integer_type || type_==bool_type || double_==(double)integer_);
+    int_=(integer_>INT_MAX ? INT_MAX : (integer_<INT_MIN ? INT_MIN : (int)integer_));
+    uint_=(integer_>(long long)UINT_MAX ? UINT_MAX : (integer_<0 ? 0 : (unsigned int)integer_));
+    bool_=(double_!=0.0);
+    exact_=0;
+    if ( integral && integer_>=INT_MIN && integer_<=INT_MAX ) exact_|=int_exact;
+    if ( integral && integer_>=0 && integer_<=(long long)UINT_MAX ) exact_|=uint_exact;
+    if ( integral && (integer_==0 || integer_==1) ) exact_|=bool_exact;
+    return *this;
+}
+
+
+config_entry::config_entry(const std::string &str)
+ : string_(), type_(string_type), integer_(0), double_(0.0), int_(0), uint_(0), bool_(false), exact_(0), success_(false), list_(), external_(0), externallength_(0)
+{
+    reinit(str);
+}
+
+
+config_entry::~config_entry()
+{
+}
+
+
+// Out of line warning for the conversion operators, so that only a 
+// single flag test remains on their fast path:
+static void __attribute__((noinline)) conversionwarning(const std::string &str, const bool success, const char *type)
+{
+    config_profile::failed()=true;
+    if ( !success ) std::cerr<<"[config] Could not interpret entry \""<<str<<"\" as "<<type<<".\n[config]\tconfig_entry::operator "<<type<<"() const\n";
+    else std::cerr<<"[config] Problems while interpreting entry \""<<str<<"\" as "<<type<<".\n[config]\tconfig_entry::operator "<<type<<"() const\n";
+}
+
+
+config_entry::operator std::string() const
+{
+    return string();
+}
+
+
+config_entry::operator float() const
+{
+    if ( !success_ ) conversionwarning(string(), success_, "float");
+    return (float)double_;
+}
+
+
+config_entry::operator double() const
+{
+    if ( !success_ ) conversionwarning(string(), success_, "double");
+    return double_;
+}
+
+
+config_entry::operator long double() const
+{
+    if ( !success_ ) conversionwarning(string(), success_, "long double");
+    return ldbl();
+}
+
+
+config_entry::operator int() const
+{
+    if ( !(exact_&int_exact) ) conversionwarning(string(), success_, "int");
+    return int_;
+}
+
+
+config_entry::operator unsigned int() const
+{
+    if ( !(exact_&uint_exact) ) conversionwarning(string(), success_, "unsigned int");
+    return uint_;
+}
+
+
+config_entry::operator bool() const
+{
+    if ( !(exact_&bool_exact) ) conversionwarning(string(), success_, "bool");
+    return bool_;
+}
+
+
+config_entry::operator char() const
+{
+    if ( empty() ) return '\0';
+    const char *str=(external_ ? external_ : string_.c_str());
+    if ( (external_ ? externallength_ : string_.length())>1 )
+    {
+	config_profile::failed()=true;
+	std::cerr<<"[config] String \""<<string()<<"\" consists of more than 1 characters.\n[config]\tconfig_entry::operator char() const\n";
+    }
+    return str[0];
+}
+
+
+std::string config_entry::string() const
+{
+    return (external_ ? std::string(external_, externallength_) : string_);
+}
+
+
+bool config_entry::empty() const
+{
+    return (external_ ? externallength_==0 : string_.empty());
+}
+
+
+long double config_entry::ldbl() const
+{
+    return (type_==integer_type ? (long double)integer_ : (long double)double_);
+}
+
+
+long long config_entry::integer() const
+{
+    return integer_;
+}
+
+
+config_entry::entry_type config_entry::type() const
+{
+    return type_;
+}
+
+
+bool config_entry::success() const
+{
+    return success_;
+}
+
+
+config_span<double> config_entry::doubles() const
+{
+    if ( list_ )
+    {
+	if ( !list_->success() )
+	{
+	    config_profile::failed()=true;
+	    std::cerr<<"[config] Could not interpret all elements of entry \""<<string()<<"\" as numbers.\n[config]\tconfig_span<double> config_entry::doubles() const\n";
+	}
+	return config_span<double>(list_, list_->doubles().data(), list_->size());
+    }
+    if ( !success_ )
+    {
+	config_profile::failed()=true;
+	std::cerr<<"[config] Could not interpret entry \""<<string()<<"\" as list of doubles.\n[config]\tconfig_span<double> config_entry::doubles() const\n";
+	return config_span<double>(0, 0);
+    }
+    const std::shared_ptr<const double> value=std::make_shared<const double>(double_);
+    return config_span<double>(value, value.get(), 1);
+}
+
+
+config_span<long long> config_entry::integers() const
+{
+    if ( list_ )
+    {
+	if ( !list_->integral() )
+	{
+	    config_profile::failed()=true;
+	    std::cerr<<"[config] Could not interpret all elements of entry \""<<string()<<"\" as integers.\n[config]\tconfig_span<long long> config_entry::integers() const\n";
+	}
+	return config_span<long long>(list_, list_->integers().data(), list_->size());
+    }
+    if ( !success_ )
+    {
+	config_profile::failed()=true;
+	std::cerr<<"[config] Could not interpret entry \""<<string()<<"\" as list of integers.\n[config]\tconfig_span<long long> config_entry::integers() const\n";
+	return config_span<long long>(0, 0);
+    }
+    if ( type_!=integer_type && type_!=bool_type && double_!=(double)integer_ )
+    {
+	config_profile::failed()=true;
+	std::cerr<<"[config] Problems while interpreting entry \""<<string()<<"\" as list of integers.\n[config]\tconfig_span<long long> config_entry::integers() const\n";
+    }
+    const std::shared_ptr<const long long> value=std::make_shared<const long long>(integer_);
+    return config_span<long long>(value, value.get(), 1);
+}
+
+
+//////////////////// Implementation of class config_profile ////////////
+
+
+// Token statistics of one thread, indexed by a config_index:
+struct config_profile::threadtable
+{
+    std::mutex mutex_;
+    std::vector< std::pair<std::string, counters> > entries_;
+    config_index index_;
+    threadtable();
+    ~threadtable();
+    counters& find(const char*, const std::size_t);
+};
+
+
+// Set when the table of the calling thread has been destroyed (records 
+// then go straight into the totals):
+static thread_local bool profiletableexited=false;
+
+
+config_profile::threadtable::threadtable()
+ : mutex_(), entries_(), index_()
+{
+    std::lock_guard<std::mutex> lock(config_profile::mutex());
+    config_profile::tables().push_back(this);
+}
+
+
+config_profile::threadtable::~threadtable()
+{
+    std::lock_guard<std::mutex> lock(config_profile::mutex());
+    std::lock_guard<std::mutex> locallock(mutex_);
+    for ( std::size_t i=0 ; i<entries_.size() ; ++i )
+    {
+	const counters &c=entries_[i].second;
+	counters &total=config_profile::table()[entries_[i].first];
+	total.lookups_+=c.lookups_;
+	total.conversions_+=c.conversions_;
+	total.failures_+=c.failures_;
+	total.nanoseconds_+=c.nanoseconds_;
+    }
+    std::vector<threadtable*> &tables=config_profile::tables();
+    tables.erase(std::find(tables.begin(), tables.end(), this));
+    profiletableexited=true;
+}
+
+
+config_profile::counters& config_profile::threadtable::find(const char *token, const std::size_t length)
+{
+    const std::pair<std::size_t, bool> p=index_.insert(config_table::hash(token, length), entries_.size(), [&](const std::size_t j) { return entries_[j].first.compare(0, std::string::npos, token, length)==0; });
+    if ( p.second )
+    {
+	const counters zero={ 0, 0, 0, 0 };
+	entries_.push_back(std::make_pair(std::string(token, length), zero));
+    }
+    return entries_[p.first].second;
+}
+
+
+config_profile::threadtable* config_profile::local()
+{
+    if ( profiletableexited ) return 0;
+    static thread_local threadtable t;
+    return &t;
+}
+
+
+std::mutex& config_profile::mutex()
+{
+    static std::mutex *m=new std::mutex;
+    return *m;
+}
+
+
+std::vector<config_profile::threadtable*>& config_profile::tables()
+{
+    static std::vector<threadtable*> *t=new std::vector<threadtable*>;
+    return *t;
+}
+
+
+std::map<std::string, config_profile::counters>& config_profile::table()
+{
+    static std::map<std::string, counters> *t=new std::map<std::string, counters>;
+    return *t;
+}
+
+
+config_profile::counters& config_profile::find(const char *token, const std::size_t length, std::unique_lock<std::mutex> &lock)
+{
+    threadtable *t=local();
+    if ( t==0 )
+    {
+	lock=std::unique_lock<std::mutex>(mutex());
+	return table()[std::string(token, length)];
+    }
+    lock=std::unique_lock<std::mutex>(t->mutex_);
+    return t->find(token, length);
+}
+
+
+config_profile::lookup::lookup(const char *token)
+ : token_(token), start_(std::chrono::steady_clock::now())
+{
+}
+
+
+config_profile::lookup::~lookup()
+{
+    recordlookup(token_, std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now()-start_).count());
+}
+
+
+void config_profile::recordlookup(const char *token, const unsigned long long nanoseconds)
+{
+    std::unique_lock<std::mutex> lock;
+    counters &c=find(token, ::strlen(token), lock);
+    ++c.lookups_;
+    c.nanoseconds_+=nanoseconds;
+}
+
+
+void config_profile::recordconversion(const std::string &token, const bool failed)
+{
+    std::unique_lock<std::mutex> lock;
+    counters &c=find(token.data(), token.length(), lock);
+    ++c.conversions_;
+    if ( failed ) ++c.failures_;
+}
+
+
+bool& config_profile::failed()
+{
+    static thread_local bool flag=false;
+    return flag;
+}
+
+
+void config_profile::report(std::ostream &out)
+{
+    std::lock_guard<std::mutex> lock(mutex());
+    std::map<std::string, counters> merged=table();
+    const std::vector<threadtable*> &live=tables();
+    for ( std::size_t t=0 ; t<live.size() ; ++t )
+    {
+	std::lock_guard<std::mutex> locallock(live[t]->mutex_);
+	for ( std::size_t i=0 ; i<live[t]->entries_.size() ; ++i )
+	{
+	    const counters &c=live[t]->entries_[i].second;
+	    counters &total=merged[live[t]->entries_[i].first];
+	    total.lookups_+=c.lookups_;
+	    total.conversions_+=c.conversions_;
+	    total.failures_+=c.failures_;
+	    total.nanoseconds_+=c.nanoseconds_;
+	}
+    }
+    if ( merged.empty() ) return;
+    std::vector< std::pair<std::string, counters> > sorted(merged.begin(), merged.end());
+    std::stable_sort(sorted.begin(), sorted.end(), [](const std::pair<std::string, counters> &a, const std::pair<std::string, counters> &b) { return a.second.lookups_>b.second.lookups_; });
+    out<<"Config access statistics (token: lookups, conversions, failed conversions, lookup time):\n";
+    for ( std::size_t i=0 ; i<sorted.size() ; ++i )
+    {
+	const counters &c=sorted[i].second;
+	out<<"  "<<sorted[i].first<<": "<<c.lookups_<<", "<<c.conversions_<<", "<<c.failures_<<", "<<c.nanoseconds_*1.0e-9<<" seconds\n";
+    }
+}
+
+
+void config_profile::clear()
+{
+    std::lock_guard<std::mutex> lock(mutex());
+    table().clear();
+    const std::vector<threadtable*> &live=tables();
+    for ( std::size_t t=0 ; t<live.size() ; ++t )
+    {
+	std::lock_guard<std::mutex> locallock(live[t]->mutex_);
+	live[t]->entries_.clear();
+	live[t]->index_.clear();
+    }
+}
+
+
+//////////////////// Implementation of class config_list ///////////////
+
+
+// Delimiters of list elements:
+static inline bool islistdelim(const char c)
+{
+    return c==',' || c==' ' || c=='\t' || c=='\r' || c=='\v' || c=='\f' || c=='=';
+}
+
+
+config_list::config_list(const std::string &str)
+ : doubles_(0), integers_(0), size_(0), success_(true), integral_(true)
+{
+    init(str.data(), str.length());
+}
+
+
+config_list::config_list(const char *str, const std::size_t length)
+ : doubles_(0), integers_(0), size_(0), success_(true), integral_(true)
+{
+    init(str, length);
+}
+
+
+void config_list::init(const char *str, const std::size_t length)
+{
+    // Elements between the brackets, counted first, so that both arrays 
+    // fit in one allocation:
+    const char *begin=str+1;
+    const char *end=str+length-1;
+    for ( const char *p=begin ; p<end ; )
+    {
+	while ( p<end && islistdelim(*p) ) ++p;
+	if ( p==end ) break;
+	while ( p<end && !islistdelim(*p) ) ++p;
+	++size_;
+    }
+    const std::size_t doublesize=((size_ ? size_ : 1)*sizeof(double)+alignment-1)/alignment*alignment;
+    void *memory=0;
+    if ( ::posix_memalign(&memory, alignment, doublesize+(size_ ? size_ : 1)*sizeof(long long))!=0 ) throw std::bad_alloc();
+    doubles_=static_cast<double*>(memory);
+    integers_=reinterpret_cast<long long*>(static_cast<char*>(memory)+doublesize);
+    // Elements are copied to be 0 terminated, short ones on the stack:
+    char buffer[64];
+    std::string longelement;
+    std::size_t i=0;
+    for ( const char *p=begin ; p<end ; ++i )
+    {
+	while ( p<end && islistdelim(*p) ) ++p;
+	if ( p==end ) break;
+	const char *q=p;
+	while ( q<end && !islistdelim(*q) ) ++q;
+	const char *element=buffer;
+	if ( (std::size_t)(q-p)<sizeof(buffer) )
+	{
+	    ::memcpy(buffer, p, q-p);
+	    buffer[q-p]='\0';
+	}
+	else
+	{
+	    longelement.assign(p, q);
+	    element=longelement.c_str();
+	}
+	p=q;
+	char *elementend=0;
+	errno=0;
+	const long long integer=::strtoll(element, &elementend, 10);
+	if ( *elementend=='\0' && errno==0 )
+	{
+	    integers_[i]=integer;
+	    doubles_[i]=(double)integer;
+	    continue;
+	}
+	double d=0.0;
+	const char *numberend=readdouble(element, d, true);
+	if ( *numberend!='\0' || numberend==element ) success_=false;
+	doubles_[i]=d;
+	integers_[i]=saturatedinteger(d);
+	if ( d!=(double)integers_[i] ) integral_=false;
+    }
+    if ( !success_ ) integral_=false;
+}
+
+
+config_list::~config_list()
+{
+    // integers_ is in the same allocation:
+    ::free(doubles_);
+}
+
+
+config_span<double> config_list::doubles() const
+{
+    return config_span<double>(doubles_, size_);
+}
+
+
+config_span<long long> config_list::integers() const
+{
+    return config_span<long long>(integers_, size_);
+}
+
+
+std::size_t config_list::size() const
+{
+    return size_;
+}
+
+
+bool config_list::success() const
+{
+    return success_;
+}
+
+
+bool config_list::integral() const
+{
+    return integral_;
+}
+
+
+const config_entry& config_entry::operator=(const config_entry &other)
+{
+    if ( other.external_ ) string_.assign(other.external_, other.externallength_);
+    else string_=other.string_;
+    type_=other.type_;
+    integer_=other.integer_;
+    double_=other.double_;
+    int_=other.int_;
+    uint_=other.uint_;
+    bool_=other.bool_;
+    exact_=other.exact_;
+    success_=other.success_;
+    list_=other.list_;
+    external_=0;
+    externallength_=0;
+    return *this;
+}
+
+
+//////////////////// Implementation of class config ////////////////////
+
+config::config()
+ : std::map< std::string, config_entry >()
+{
+}
+
+
+config::config(const config &other)
+ : std::map< std::string, config_entry >(other)
+{
+}
+
+
+config::~config()
+{
+}
+
+
+// Token delimiters of a config line: the whitespace characters 
+// recognized by operator>>, and '=':
+static inline bool isconfigdelim(const char c)
+{
+    return c==' ' || c=='\t' || c=='=' || c=='\n' || c=='\r' || c=='\v' || c=='\f';
+}
+
+
+// Split a config line [begin, end) into token and value. Returns false 
+// for lines which do not define an entry:
+static bool splitconfigline(const char *begin, const char *end, const char *&token, const char *&tokenend, const char *&value, const char *&valueend)
+{
+    if ( begin==end ) return false;
+    if ( *begin=='#' ) return false;
+    const char *p=begin;
+    while ( p!=end && isconfigdelim(*p) ) ++p;
+    if ( p==end ) return false;
+    token=p;
+    while ( p!=end && !isconfigdelim(*p) ) ++p;
+    tokenend=p;
+    while ( p!=end && isconfigdelim(*p) ) ++p;
+    if ( p==end )
+    {
+	std::string linebuff(begin, end);
+	for ( unsigned int i=0 ; i<linebuff.length() ; ++i ) if ( linebuff[i]=='=' ) linebuff[i]=' ';
+	std::cerr<<"[config] Could not extract config value from line:\n[config] "<<linebuff<<"\n[config]\nconfig& config::append(std::ifstream&)\n";
+	return false;
+    }
+    value=p;
+    // A list value extends to the closing bracket at the end of the line:
+    if ( *p=='[' )
+    {
+	const char *last=end;
+	while ( isconfigdelim(*(last-1)) ) --last;
+	if ( *(last-1)==']' )
+	{
+	    valueend=last;
+	    return true;
+	}
+    }
+    while ( p!=end && !isconfigdelim(*p) ) ++p;
+    valueend=p;
+    while ( p!=end && isconfigdelim(*p) ) ++p;
+    if ( p!=end )
+    {
+	std::string linebuff(begin, end);
+	for ( unsigned int i=0 ; i<linebuff.length() ; ++i ) if ( linebuff[i]=='=' ) linebuff[i]=' ';
+	std::cerr<<"[config] An other entry is also present after config value in line:\n[config] "<<linebuff<<"\n[config]\tconfig& config::append(std::ifstream&)\n";
+    }
+    return true;
+}
+
+
+//////////////////// Implementation of class config_image //////////////
+
+
+// Layout of a config image (native byte order):
+//   configimage_header
+//   configimage_record[nentries_], sorted by token
+//   string table (tokens and values, not terminated)
+// The checksum covers everything after the header.
+static const char configimage_magic[8]={ 'C', 'O', 'N', 'F', 'I', 'M', 'G', '\0' };
+static const unsigned int configimage_version=2;
+
+struct configimage_header
+{
+    char magic_[8];
+    uint32_t version_;
+    uint32_t nentries_;
+    uint64_t sourcesize_;
+    int64_t sourcemtime_sec_;
+    int64_t sourcemtime_nsec_;
+    uint64_t checksum_;
+    uint64_t stringsoffset_;
+    uint64_t stringssize_;
+};
+
+struct configimage_record
+{
+    uint64_t tokenoffset_;
+    uint64_t valueoffset_;
+    uint32_t tokenlength_;
+    uint32_t valuelength_;
+    int64_t integer_;
+    double double_;
+    int32_t int_;
+    uint32_t uint_;
+    uint8_t type_;
+    uint8_t bool_;
+    uint8_t exact_;
+    uint8_t success_;
+    uint32_t padding_;
+};
+
+
+std::string config_image::imagename(const std::string &filename)
+{
+    return filename+".bin";
+}
+
+
+template <class C>
+bool config_image::load(C &conf, const std::string &path, const struct stat &source)
+{
+    const std::string image=imagename(path);
+    const int fd=::open(image.c_str(), O_RDONLY);
+    if ( fd<0 ) return false;
+    struct stat st;
+    if ( ::fstat(fd, &st)!=0 || (std::size_t)st.st_size<sizeof(configimage_header) || st.st_mtim.tv_sec<source.st_mtim.tv_sec || (st.st_mtim.tv_sec==source.st_mtim.tv_sec && st.st_mtim.tv_nsec<source.st_mtim.tv_nsec) )
+    {
+	::close(fd);
+	return false;
+    }
+    void *data=::mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if ( data==MAP_FAILED ) return false;
+    const char *begin=static_cast<const char*>(data);
+    const configimage_header &header=*reinterpret_cast<const configimage_header*>(begin);
+    const bool valid=::memcmp(header.magic_, configimage_magic, sizeof(configimage_magic))==0 && header.version_==configimage_version
+	&& header.sourcesize_==(uint64_t)source.st_size && header.sourcemtime_sec_==(int64_t)source.st_mtim.tv_sec && header.sourcemtime_nsec_==(int64_t)source.st_mtim.tv_nsec
+	&& sizeof(configimage_header)+(uint64_t)header.nentries_*sizeof(configimage_record)<=header.stringsoffset_
+	&& header.stringsoffset_<=(uint64_t)st.st_size && header.stringssize_==(uint64_t)st.st_size-header.stringsoffset_;
+    if ( !valid )
+    {
+	::munmap(data, st.st_size);
+	return false;
+    }
+    // Validate the whole image before inserting anything, so that a 
+    // corrupt image falls back to the text file without leftovers:
+    const configimage_record *records=reinterpret_cast<const configimage_record*>(begin+sizeof(configimage_header));
+    const char *strings=begin+header.stringsoffset_;
+    bool corrupt=(header.checksum_!=(uint64_t)config_table::hash(begin+sizeof(configimage_header), st.st_size-sizeof(configimage_header)));
+    for ( uint32_t i=0 ; i<header.nentries_ && !corrupt ; ++i )
+    {
+	const configimage_record &r=records[i];
+	corrupt=(r.tokenoffset_>header.stringssize_ || r.tokenlength_>header.stringssize_-r.tokenoffset_
+	    || r.valueoffset_>header.stringssize_ || r.valuelength_>header.stringssize_-r.valueoffset_
+	    || r.type_>config_entry::list_type);
+    }
+    if ( corrupt )
+    {
+	std::cerr<<"[config] Corrupt config image "<<image<<" !\n[config]\tbool config_image::load(C&, const std::string&, const struct stat&)\n";
+	::munmap(data, st.st_size);
+	return false;
+    }
+    for ( uint32_t i=0 ; i<header.nentries_ ; ++i )
+    {
+	const configimage_record &r=records[i];
+	config_entry &entry=conf[std::string(strings+r.tokenoffset_, r.tokenlength_)];
+	entry.string_.assign(strings+r.valueoffset_, r.valuelength_);
+	entry.external_=0;
+	entry.externallength_=0;
+	entry.type_=(config_entry::entry_type)r.type_;
+	entry.integer_=r.integer_;
+	entry.double_=r.double_;
+	entry.int_=r.int_;
+	entry.uint_=r.uint_;
+	entry.bool_=(r.bool_!=0);
+	entry.exact_=r.exact_;
+	entry.success_=(r.success_!=0);
+	entry.list_.reset();
+	if ( entry.type_==config_entry::list_type ) entry.reinit(entry.string_);
+    }
+    ::munmap(data, st.st_size);
+    return true;
+}
+
+
+bool config_image::compile(const std::string &filename, const std::string &image)
+{
+    std::string path;
+    struct stat source;
+    if ( std::isinpipe(filename, path)!=0 || ::stat(path.c_str(), &source)!=0 || !S_ISREG(source.st_mode) )
+    {
+	std::cerr<<"[config] Can only compile plain config files, not "<<filename<<" !\n[config]\tbool config_image::compile(const std::string&, const std::string&)\n";
+	return false;
+    }
+    std::ifstream file(path.c_str(), std::ios::in|std::ios::binary);
+    std::string text((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    if ( !file.eof() && file.fail() )
+    {
+	std::cerr<<"[config] Could not read config file "<<filename<<" !\n[config]\tbool config_image::compile(const std::string&, const std::string&)\n";
+	return false;
+    }
+    config conf;
+    conf.append(text.data(), text.length());
+
+    configimage_header header;
+    ::memset(&header, 0, sizeof(header));
+    ::memcpy(header.magic_, configimage_magic, sizeof(configimage_magic));
+    header.version_=configimage_version;
+    header.nentries_=conf.size();
+    header.sourcesize_=source.st_size;
+    header.sourcemtime_sec_=source.st_mtim.tv_sec;
+    header.sourcemtime_nsec_=source.st_mtim.tv_nsec;
+    header.stringsoffset_=sizeof(configimage_header)+conf.size()*sizeof(configimage_record);
+    std::vector<configimage_record> records;
+    records.reserve(conf.size());
+    std::string strings;
+    for ( config::const_iterator it=conf.begin() ; it!=conf.end() ; ++it )
+    {
+	const config_entry &entry=it->second;
+	configimage_record r;
+	::memset(&r, 0, sizeof(r));
+	r.tokenoffset_=strings.length();
+	r.tokenlength_=it->first.length();
+	strings+=it->first;
+	r.valueoffset_=strings.length();
+	r.valuelength_=entry.string_.length();
+	strings+=entry.string_;
+	r.integer_=entry.integer_;
+	r.double_=entry.double_;
+	r.int_=entry.int_;
+	r.uint_=entry.uint_;
+	r.type_=entry.type_;
+	r.bool_=entry.bool_;
+	r.exact_=entry.exact_;
+	r.success_=entry.success_;
+	records.push_back(r);
+    }
+    header.stringssize_=strings.length();
+    std::string body;
+    body.reserve(records.size()*sizeof(configimage_record)+strings.length());
+    if ( !records.empty() ) body.append(reinterpret_cast<const char*>(&records[0]), records.size()*sizeof(configimage_record));
+    body+=strings;
+    header.checksum_=config_table::hash(body.data(), body.length());
+
+    // Write into a temporary file, then rename, so that readers never 
+    // map a partially written image:
+    const std::string tmpname=(image.empty() ? imagename(path) : image)+".tmp";
+    std::ofstream out(tmpname.c_str(), std::ios::out|std::ios::binary|std::ios::trunc);
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.write(body.data(), body.length());
+    out.close();
+    if ( !out || ::rename(tmpname.c_str(), (image.empty() ? imagename(path) : image).c_str())!=0 )
+    {
+	std::cerr<<"[config] Could not write config image "<<tmpname<<" !\n[config]\tbool config_image::compile(const std::string&, const std::string&)\n";
+	::unlink(tmpname.c_str());
+	return false;
+    }
+    return true;
+}
+
+
+bool compileconfig(const std::string &filename, const std::string &image)
+{
+    return config_image::compile(filename, image);
+}
+
+
+// Append a config file buffer to a config container C, parsed by the 
+// given number of threads:
+template <class C>
+static void appendbuffer(C &conf, const char *data, const std::size_t length, const unsigned int nthreads)
+{
+    if ( nthreads==1 ) conf.append(data, length);
+    else conf.appendparallel(data, length, nthreads);
+}
+
+
+// config_pool is only parsed sequentially:
+static void appendbuffer(config_pool &conf, const char *data, const std::size_t length, const unsigned int)
+{
+    conf.append(data, length);
+}
+
+
+// Append a config file to a config container C (config, config_table, 
+// config_pool). Plain files are loaded from their compiled image if it 
+// is up to date; otherwise the file is read through the stream of 
+// openin, whole into a buffer if it is parsed by several threads:
+template <class C>
+static C& appendconfigfile(C &conf, const std::string &filename, const unsigned int nthreads=1)
+{
+    std::string path;
+    struct stat st;
+    if ( std::isinpipe(filename, path)==0 && ::stat(path.c_str(), &st)==0 && S_ISREG(st.st_mode) && config_image::load(conf, path, st) ) return conf;
+    std::istream *file=std::openin(filename);
+    if ( !(*file) )
+    {
+	std::cerr<<"[config] Could not open config file "<<filename<<" !\n[config]\nconfig& config::append(const std::string&)";
+	delete file;
+	return conf;
+    }
+    if ( nthreads==1 ) conf.append(*file);
+    else
+    {
+	std::ostringstream buffer;
+	buffer<<file->rdbuf();
+	const std::string data=buffer.str();
+	appendbuffer(conf, data.data(), data.length(), nthreads);
+    }
+    delete file;
+    return conf;
+}
+
+
+// Call a function with the token [token, tokenend) and value [value, 
+// valueend) of each line of a config file buffer [data, end) which 
+// defines an entry:
+template <class F>
+static void foreachconfigline(const char *data, const char *end, F entry)
+{
+    const char *token, *tokenend, *value, *valueend;
+    while ( data!=end )
+    {
+	const char *lineend=static_cast<const char*>(::memchr(data, '\n', end-data));
+	if ( lineend==0 ) lineend=end;
+	if ( splitconfigline(data, lineend, token, tokenend, value, valueend) ) entry(token, tokenend, value, valueend);
+	data=(lineend==end ? end : lineend+1);
+    }
+}
+
+
+// The same, for a config file stream:
+template <class F>
+static void foreachconfigline(std::istream &file, F entry)
+{
+    const char *token, *tokenend, *value, *valueend;
+    std::string linebuff;
+    while ( std::getline(file, linebuff) )
+    {
+	if ( splitconfigline(linebuff.data(), linebuff.data()+linebuff.length(), token, tokenend, value, valueend) ) entry(token, tokenend, value, valueend);
+    }
+}
+
+
+// Entries of a chunk of a config file:
+typedef std::vector< std::pair<std::string, config_entry> > configchunk;
+
+
+// Parse the lines [data, end) into entries. If sorted is requested, 
+// the entries are sorted by token, and of repeated tokens only the 
+// last one is kept; otherwise they are kept in line order:
+static void parseconfigchunk(const char *data, const char *end, configchunk &entries, const bool sorted)
+{
+    foreachconfigline(data, end, [&entries](const char *token, const char *tokenend, const char *value, const char *valueend) {
+	entries.push_back(std::make_pair(std::string(token, tokenend), config_entry(std::string(value, valueend))));
+    });
+    if ( !sorted ) return;
+    std::stable_sort(entries.begin(), entries.end(), [](const configchunk::value_type &a, const configchunk::value_type &b) { return a.first<b.first; });
+    std::size_t j=0;
+    for ( std::size_t i=0 ; i<entries.size() ; ++i )
+    {
+	if ( i+1<entries.size() && entries[i+1].first==entries[i].first ) continue;
+	if ( j!=i ) entries[j]=entries[i];
+	++j;
+    }
+    entries.resize(j);
+}
+
+
+// Smallest chunk of a config file buffer worth a thread of its own 
+// (below that, creating and joining the thread and merging the chunks 
+// cost more than the parsing saves):
+static const std::size_t minconfigchunk=1<<20;
+
+
+// Number of threads to parse a config file buffer of the given length 
+// with (0 requested: one per core), at most one per minconfigchunk 
+// bytes (1: parse sequentially):
+static unsigned int parsethreads(const std::size_t length, unsigned int nthreads)
+{
+    if ( nthreads==0 ) nthreads=std::thread::hardware_concurrency();
+    if ( nthreads==0 ) nthreads=1;
+    const std::size_t maxthreads=length/minconfigchunk;
+    if ( maxthreads<nthreads ) nthreads=(maxthreads>0 ? maxthreads : 1);
+    return nthreads;
+}
+
+
+// Split a config file buffer at line boundaries into chunks, and parse 
+// them concurrently:
+static void parseconfigchunks(const char *data, const std::size_t length, const unsigned int nthreads, const bool sorted, std::vector<configchunk> &chunks)
+{
+    const char *end=data+length;
+    std::vector<const char*> bounds(1, data);
+    for ( unsigned int i=1 ; i<nthreads ; ++i )
+    {
+	const char *p=data+(std::size_t)((double)length*i/nthreads);
+	if ( p<bounds.back() ) p=bounds.back();
+	const char *newline=(p==end ? 0 : static_cast<const char*>(::memchr(p, '\n', end-p)));
+	bounds.push_back(newline==0 ? end : newline+1);
+    }
+    bounds.push_back(end);
+    chunks.assign(nthreads, configchunk());
+    std::vector<std::thread> threads;
+    for ( unsigned int i=1 ; i<nthreads ; ++i ) threads.push_back(std::thread(parseconfigchunk, bounds[i], bounds[i+1], std::ref(chunks[i]), sorted));
+    parseconfigchunk(bounds[0], bounds[1], chunks[0], sorted);
+    for ( unsigned int i=0 ; i<threads.size() ; ++i ) threads[i].join();
+}
+
+
+void config::appendentry(const char *token, const char *tokenend, const char *value, const char *valueend)
+{
+    // The token is copied into a reused buffer, the node is only 
+    // created for a new token (in place, at the position found), and 
+    // the value is copied straight into the entry:
+    static thread_local std::string key;
+    key.assign(token, tokenend);
+    iterator it=lower_bound(key);
+    if ( it==this->end() || it->first!=key ) it=emplace_hint(it, std::piecewise_construct, std::forward_as_tuple(key), std::forward_as_tuple());
+    it->second.reinit(value, valueend-value);
+}
+
+
+config& config::append(std::istream &file)
+{
+    foreachconfigline(file, [this](const char *token, const char *tokenend, const char *value, const char *valueend) { appendentry(token, tokenend, value, valueend); });
+    return *this;
+}
+
+
+config& config::append(const char *data, const std::size_t length)
+{
+    foreachconfigline(data, data+length, [this](const char *token, const char *tokenend, const char *value, const char *valueend) { appendentry(token, tokenend, value, valueend); });
+    return *this;
+}
+
+
+config& config::appendparallel(const char *data, const std::size_t length, const unsigned int nthreads)
+{
+    const unsigned int threads=parsethreads(length, nthreads);
+    if ( threads==1 ) return append(data, length);
+    std::vector<configchunk> chunks;
+    parseconfigchunks(data, length, threads, true, chunks);
+    if ( !empty() )
+    {
+	for ( std::size_t c=0 ; c<chunks.size() ; ++c )
+	{
+	    for ( std::size_t i=0 ; i<chunks[c].size() ; ++i ) (*this)[chunks[c][i].first]=chunks[c][i].second;
+	}
+	return *this;
+    }
+    // Merge the sorted chunks, then every insertion goes to the end of 
+    // the map. Of equal tokens, the one from the last chunk wins:
+    typedef std::pair<std::size_t, std::size_t> head;
+    const std::vector<configchunk> &c=chunks;
+    std::priority_queue< head, std::vector<head>, std::function<bool(const head&, const head&)> > heads(
+	[&c](const head &a, const head &b) { return c[b.first][b.second].first<c[a.first][a.second].first; });
+    for ( std::size_t i=0 ; i<c.size() ; ++i ) if ( !c[i].empty() ) heads.push(head(i, 0));
+    while ( !heads.empty() )
+    {
+	head best=heads.top();
+	const std::string &token=c[best.first][best.second].first;
+	do
+	{
+	    const head h=heads.top();
+	    heads.pop();
+	    if ( h.first>best.first ) best=h;
+	    if ( h.second+1<c[h.first].size() ) heads.push(head(h.first, h.second+1));
+	}
+	while ( !heads.empty() && c[heads.top().first][heads.top().second].first==token );
+	std::map< std::string, config_entry >::insert(end(), c[best.first][best.second]);
+    }
+    return *this;
+}
+
+
+config& config::appendparallel(const std::string &filename, const unsigned int nthreads)
+{
+    return appendconfigfile(*this, filename, nthreads);
+}
+
+
+config& config::append(const std::string &filename)
+{
+    return appendconfigfile(*this, filename);
+}
+
+
+config::config(std::istream &file)
+ : std::map< std::string, config_entry >()
+{
+    append(file);
+}
+
+
+config::config(const std::string &filename)
+ : std::map< std::string, config_entry >()
+{
+    append(filename);
+}
+
+
+config& config::clear()
+{
+    std::map< std::string, config_entry >::clear();
+    return *this;
+}
+
+
+const config_entry* config::find(const std::string &token) const
+{
+    const_iterator it=std::map< std::string, config_entry >::find(token);
+    return (it==end() ? 0 : &it->second);
+}
+
+
+//////////////////// Implementation of class config_index //////////////
+
+
+config_index::config_index()
+ : slots_(), size_(0)
+{
+}
+
+
+void config_index::reserve(const std::size_t n)
+{
+    // Keep the load factor below 1/2:
+    std::size_t nslots=16;
+    while ( nslots<2*n ) nslots*=2;
+    if ( nslots<=slots_.size() ) return;
+    std::vector<slot> old;
+    old.swap(slots_);
+    const slot empty={0, 0};
+    slots_.assign(nslots, empty);
+    const std::size_t mask=nslots-1;
+    for ( std::size_t j=0 ; j<old.size() ; ++j )
+    {
+	if ( old[j].index_==0 ) continue;
+	std::size_t i=old[j].hash_&mask;
+	while ( slots_[i].index_!=0 ) i=(i+1)&mask;
+	slots_[i]=old[j];
+    }
+}
+
+
+void config_index::clear()
+{
+    slots_.clear();
+    size_=0;
+}
+
+
+//////////////////// Implementation of class config_table //////////////
+
+
+const config_entry config_table::empty_;
+
+
+config_table::config_table()
+ : entries_(), index_()
+{
+}
+
+
+config_table::config_table(const config_table &other)
+ : entries_(other.entries_), index_(other.index_)
+{
+}
+
+
+config_table::config_table(const config &conf)
+ : entries_(), index_()
+{
+    index_.reserve(conf.size());
+    for ( config::const_iterator it=conf.begin() ; it!=conf.end() ; ++it ) (*this)[it->first]=it->second;
+}
+
+
+config_table::config_table(std::istream &file)
+ : entries_(), index_()
+{
+    append(file);
+}
+
+
+config_table::config_table(const std::string &filename)
+ : entries_(), index_()
+{
+    append(filename);
+}
+
+
+config_table::~config_table()
+{
+}
+
+
+std::size_t config_table::hash(const char *key, const std::size_t length)
+{
+    // 64 bit FNV-1a:
+    unsigned long long h=14695981039346656037ULL;
+    for ( std::size_t i=0 ; i<length ; ++i )
+    {
+	h^=(unsigned char)key[i];
+	h*=1099511628211ULL;
+    }
+    return (std::size_t)h;
+}
+
+
+config_entry& config_table::operator[](const std::string &key)
+{
+    const std::pair<std::size_t, bool> p=index_.insert(hash(key.data(), key.length()), entries_.size(), [&](const std::size_t j) { return entries_[j].first==key; });
+    if ( p.second ) entries_.push_back(std::make_pair(key, config_entry()));
+    return entries_[p.first].second;
+}
+
+
+const config_entry* config_table::find(const char *key, const std::size_t length) const
+{
+    const std::size_t i=index_.find(hash(key, length), [&](const std::size_t j) { const std::string &other=entries_[j].first; return other.length()==length && ::memcmp(other.data(), key, length)==0; });
+    return (i==config_index::npos ? 0 : &entries_[i].second);
+}
+
+
+const config_entry* config_table::find(const char *key) const
+{
+    return find(key, ::strlen(key));
+}
+
+
+const config_entry* config_table::find(const std::string &key) const
+{
+    return find(key.data(), key.length());
+}
+
+
+std::size_t config_table::size() const
+{
+    return entries_.size();
+}
+
+
+void config_table::appendentry(const char *token, const char *tokenend, const char *value, const char *valueend)
+{
+    // The token is copied into a reused buffer, the value straight 
+    // into the entry:
+    static thread_local std::string key;
+    key.assign(token, tokenend);
+    (*this)[key].reinit(value, valueend-value);
+}
+
+
+config_table& config_table::append(std::istream &file)
+{
+    foreachconfigline(file, [this](const char *token, const char *tokenend, const char *value, const char *valueend) { appendentry(token, tokenend, value, valueend); });
+    return *this;
+}
+
+
+config_table& config_table::append(const char *data, const std::size_t length)
+{
+    foreachconfigline(data, data+length, [this](const char *token, const char *tokenend, const char *value, const char *valueend) { appendentry(token, tokenend, value, valueend); });
+    return *this;
+}
+
+
+config_table& config_table::appendparallel(const char *data, const std::size_t length, const unsigned int nthreads)
+{
+    const unsigned int threads=parsethreads(length, nthreads);
+    if ( threads==1 ) return append(data, length);
+    std::vector<configchunk> chunks;
+    parseconfigchunks(data, length, threads, false, chunks);
+    std::size_t n=entries_.size();
+    for ( std::size_t c=0 ; c<chunks.size() ; ++c ) n+=chunks[c].size();
+    index_.reserve(n);
+    for ( std::size_t c=0 ; c<chunks.size() ; ++c )
+    {
+	for ( std::size_t i=0 ; i<chunks[c].size() ; ++i ) (*this)[chunks[c][i].first]=chunks[c][i].second;
+    }
+    return *this;
+}
+
+
+config_table& config_table::appendparallel(const std::string &filename, const unsigned int nthreads)
+{
+    return appendconfigfile(*this, filename, nthreads);
+}
+
+
+config_table& config_table::append(const std::string &filename)
+{
+    return appendconfigfile(*this, filename);
+}
+
+
+config_table& config_table::clear()
+{
+    entries_.clear();
+    index_.clear();
+    return *this;
+}
+
+
+//////////////////// Implementation of class config_pool ///////////////
+
+
+const config_entry config_pool::empty_;
+
+
+config_pool::config_pool()
+ : blocks_(), blocknext_(0), blockfree_(0), arenasize_(0), chunks_(), size_(0), index_()
+{
+}
+
+
+config_pool::config_pool(std::istream &file)
+ : blocks_(), blocknext_(0), blockfree_(0), arenasize_(0), chunks_(), size_(0), index_()
+{
+    append(file);
+}
+
+
+config_pool::config_pool(const std::string &filename)
+ : blocks_(), blocknext_(0), blockfree_(0), arenasize_(0), chunks_(), size_(0), index_()
+{
+    append(filename);
+}
+
+
+config_pool::~config_pool()
+{
+    clear();
+}
+
+
+char* config_pool::allocate(const std::size_t length)
+{
+    if ( length>blockfree_ )
+    {
+	const std::size_t size=(length>blocksize ? length : blocksize);
+	blocks_.push_back(static_cast<char*>(::operator new(size)));
+	blocknext_=blocks_.back();
+	blockfree_=size;
+    }
+    char *result=blocknext_;
+    blocknext_+=length;
+    blockfree_-=length;
+    arenasize_+=length;
+    return result;
+}
+
+
+const char* config_pool::store(const char *str, const std::size_t length)
+{
+    char *result=allocate(length+1);
+    ::memcpy(result, str, length);
+    result[length]='\0';
+    return result;
+}
+
+
+config_pool::record& config_pool::at(const std::size_t i) const
+{
+    return chunks_[i/chunksize][i%chunksize];
+}
+
+
+config_entry& config_pool::insert(const char *token, const std::size_t length)
+{
+    const std::pair<std::size_t, bool> p=index_.insert(config_table::hash(token, length), size_, [&](const std::size_t j) { const record &r=at(j); return r.tokenlength_==length && ::memcmp(r.token_, token, length)==0; });
+    if ( p.second )
+    {
+	if ( size_%chunksize==0 ) chunks_.push_back(static_cast<record*>(::operator new(chunksize*sizeof(record))));
+	record *r=new (&chunks_.back()[size_%chunksize]) record();
+	++size_;
+	r->token_=store(token, length);
+	r->tokenlength_=length;
+    }
+    return at(p.first).entry_;
+}
+
+
+config_entry& config_pool::operator[](const std::string &token)
+{
+    return insert(token.data(), token.length());
+}
+
+
+const config_entry* config_pool::find(const char *token, const std::size_t length) const
+{
+    const std::size_t i=index_.find(config_table::hash(token, length), [&](const std::size_t j) { const record &r=at(j); return r.tokenlength_==length && ::memcmp(r.token_, token, length)==0; });
+    return (i==config_index::npos ? 0 : &at(i).entry_);
+}
+
+
+const config_entry* config_pool::find(const char *token) const
+{
+    return find(token, ::strlen(token));
+}
+
+
+const config_entry* config_pool::find(const std::string &token) const
+{
+    return find(token.data(), token.length());
+}
+
+
+std::size_t config_pool::size() const
+{
+    return size_;
+}
+
+
+std::size_t config_pool::arenasize() const
+{
+    return arenasize_;
+}
+
+
+void config_pool::appendentry(const char *token, const char *tokenend, const char *value, const char *valueend)
+{
+    config_entry &entry=insert(token, tokenend-token);
+    entry.reinitexternal(store(value, valueend-value), valueend-value);
+}
+
+
+config_pool& config_pool::append(std::istream &file)
+{
+    foreachconfigline(file, [this](const char *token, const char *tokenend, const char *value, const char *valueend) { appendentry(token, tokenend, value, valueend); });
+    return *this;
+}
+
+
+config_pool& config_pool::append(const char *data, const std::size_t length)
+{
+    foreachconfigline(data, data+length, [this](const char *token, const char *tokenend, const char *value, const char *valueend) { appendentry(token, tokenend, value, valueend); });
+    return *this;
+}
+
+
+config_pool& config_pool::append(const std::string &filename)
+{
+    return appendconfigfile(*this, filename);
+}
+
+
+config_pool& config_pool::clear()
+{
+    for ( std::size_t i=0 ; i<size_ ; ++i ) at(i).~record();
+    for ( std::size_t i=0 ; i<chunks_.size() ; ++i ) ::operator delete(chunks_[i]);
+    chunks_.clear();
+    size_=0;
+    index_.clear();
+    for ( std::size_t i=0 ; i<blocks_.size() ; ++i ) ::operator delete(blocks_[i]);
+    blocks_.clear();
+    blocknext_=0;
+    blockfree_=0;
+    arenasize_=0;
+    return *this;
+}
+
+
+//////////////////// Implementation of class config_layers /////////////
+
+
+const config_entry config_layers::empty_;
+
+
+config_layers::config_layers()
+ : layers_()
+{
+}
+
+
+config_layers::config_layers(const config_layers &other)
+ : layers_(other.layers_)
+{
+}
+
+
+config_layers::~config_layers()
+{
+}
+
+
+config_layers& config_layers::push(const std::shared_ptr<const config> &layer)
+{
+    if ( layer ) layers_.push_back(layer);
+    return *this;
+}
+
+
+config_layers& config_layers::push(const std::string &filename)
+{
+    return push(getcachedconfig(filename));
+}
+
+
+config_layers& config_layers::pop()
+{
+    if ( !layers_.empty() ) layers_.pop_back();
+    return *this;
+}
+
+
+std::size_t config_layers::size() const
+{
+    return layers_.size();
+}
+
+
+const config_entry* config_layers::find(const std::string &token) const
+{
+    for ( std::size_t i=layers_.size() ; i>0 ; --i )
+    {
+	const config_entry *entry=layers_[i-1]->find(token);
+	if ( entry!=0 ) return entry;
+    }
+    return 0;
+}
+
+
+std::shared_ptr<const config> getargconfig(const int argc, const char* const *argv)
+{
+    std::shared_ptr<config> conf=std::make_shared<config>();
+    for ( int i=0 ; i<argc ; ++i )
+    {
+	if ( ::strchr(argv[i], '=')==0 && ::strchr(argv[i], ' ')==0 ) continue;
+	conf->append(argv[i], ::strlen(argv[i]));
+    }
+    return conf;
+}
+
+
+std::shared_ptr<const config> getenvconfig(const std::string &prefix)
+{
+    std::shared_ptr<config> conf=std::make_shared<config>();
+    for ( char **env=environ ; *env!=0 ; ++env )
+    {
+	if ( ::strncmp(*env, prefix.c_str(), prefix.length())!=0 ) continue;
+	const char *line=*env+prefix.length();
+	conf->append(line, ::strlen(line));
+    }
+    return conf;
+}
+
+
+//////////////////// Implementation of class reloadable_config /////////
+
+
+reloadable_config::reloadable_config(const std::string &filename)
+ : filename_(filename), current_(std::make_shared<const config>()), mutex_(), reloadmutex_(), generation_(0), inotifyfd_(-1), stopfd_(-1), watcher_()
+{
+    reload();
+    std::string path;
+    if ( std::isinpipe(filename_, path)!=0 )
+    {
+	std::cerr<<"[config] Cannot watch config pipe "<<filename_<<" !\n[config]\treloadable_config::reloadable_config(const std::string&)\n";
+	return;
+    }
+    // Watch the directory, so that replacement by rename is also seen:
+    const std::string::size_type slash=path.rfind('/');
+    const std::string dir=(slash==std::string::npos ? "." : (slash==0 ? "/" : path.substr(0, slash)));
+    inotifyfd_=::inotify_init1(IN_CLOEXEC);
+    stopfd_=::eventfd(0, EFD_CLOEXEC);
+    if ( inotifyfd_<0 || stopfd_<0 || ::inotify_add_watch(inotifyfd_, dir.c_str(), IN_CLOSE_WRITE|IN_MOVED_TO)<0 )
+    {
+	std::cerr<<"[config] Could not watch config file "<<filename_<<" !\n[config]\treloadable_config::reloadable_config(const std::string&)\n";
+	return;
+    }
+    watcher_=std::thread(&reloadable_config::watch, this);
+}
+
+
+reloadable_config::~reloadable_config()
+{
+    if ( watcher_.joinable() )
+    {
+	const uint64_t one=1;
+	if ( ::write(stopfd_, &one, sizeof(one))!=sizeof(one) ) std::cerr<<"[config] Could not stop config watcher!\n[config]\treloadable_config::~reloadable_config()\n";
+	watcher_.join();
+    }
+    if ( inotifyfd_>=0 ) ::close(inotifyfd_);
+    if ( stopfd_>=0 ) ::close(stopfd_);
+}
+
+
+void reloadable_config::watch()
+{
+    std::string path;
+    std::isinpipe(filename_, path);
+    const std::string::size_type slash=path.rfind('/');
+    const std::string base=(slash==std::string::npos ? path : path.substr(slash+1));
+    char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    pollfd fds[2]={ { inotifyfd_, POLLIN, 0 }, { stopfd_, POLLIN, 0 } };
+    while ( true )
+    {
+	if ( ::poll(fds, 2, -1)<0 )
+	{
+	    if ( errno==EINTR ) continue;
+	    std::cerr<<"[config] Polling config file "<<filename_<<" failed!\n[config]\tvoid reloadable_config::watch()\n";
+	    return;
+	}
+	if ( fds[1].revents ) return;
+	const ssize_t length=::read(inotifyfd_, buffer, sizeof(buffer));
+	if ( length<=0 ) continue;
+	bool changed=false;
+	for ( const char *p=buffer ; p<buffer+length ; )
+	{
+	    const inotify_event *event=reinterpret_cast<const inotify_event*>(p);
+	    if ( event->len>0 && base==event->name ) changed=true;
+	    p+=sizeof(inotify_event)+event->len;
+	}
+	if ( changed ) reload();
+    }
+}
+
+
+bool reloadable_config::reload()
+{
+    // Reloads from user threads and from the watcher are serialized, so 
+    // that an older parse can not replace a newer snapshot:
+    std::lock_guard<std::mutex> reloadlock(reloadmutex_);
+    std::string path;
+    if ( std::isinpipe(filename_, path)==0 && ::access(path.c_str(), R_OK)!=0 ) return false;
+    std::shared_ptr<const config> conf=std::make_shared<const config>(filename_);
+    {
+	std::lock_guard<std::mutex> lock(mutex_);
+	current_.swap(conf);
+    }
+    generation_.fetch_add(1, std::memory_order_release);
+    return true;
+}
+
+
+std::shared_ptr<const config> reloadable_config::snapshot() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return current_;
+}
+
+
+unsigned long reloadable_config::generation() const
+{
+    return generation_.load(std::memory_order_acquire);
+}
+
+
+config_snapshot::config_snapshot(const reloadable_config &source)
+ : source_(source), conf_(), generation_(source.generation())
+{
+    conf_=source_.snapshot();
+}
+
+
+bool config_snapshot::refresh()
+{
+    const unsigned long generation=source_.generation();
+    if ( generation==generation_ ) return false;
+    generation_=generation;
+    conf_=source_.snapshot();
+    return true;
+}
+
+
+const config& config_snapshot::operator*() const
+{
+    return *conf_;
+}
+
+
+const config* config_snapshot::operator->() const
+{
+    return conf_.get();
+}
+
+
+//////////////////// Implementation of getconfig functions /////////////
+
+
+#ifdef __CONFIG_PROFILING
+static inline const char* tokencstr(const char *token)
+{
+    return token;
+}
+
+
+static inline const char* tokencstr(const std::string &token)
+{
+    return token.c_str();
+}
+#endif
+
+
+// Look up a token (timing the lookup when profiling), and report it if 
+// it is missing or empty, naming the getconfig function by signature. 
+// Returns 0 in that case:
+template <class C, class T>
+static const config_entry* lookupentry(const C &conf, const T &token, const char *signature)
+{
+#ifdef __CONFIG_PROFILING
+    const config_profile::lookup timer(tokencstr(token));
+#endif
+    const config_entry *entry=conf.find(token);
+    if ( entry==0 || entry->empty() )
+    {
+	std::cerr<<"[config] "<<token<<" is not specified in configfile!\n[config]\t"<<signature<<"\n";
+	return 0;
+    }
+    return entry;
+}
+
+
+config_entry getconfig(const config &conf, const std::string &token)
+{
+    const config_entry *entry=lookupentry(conf, token, "config_entry getconfig(const config&, const std::string&)");
+    return (entry==0 ? config_entry() : *entry);
+}
+
+
+const config_entry& getconfig(const config_table &conf, const char *token)
+{
+    const config_entry *entry=lookupentry(conf, token, "const config_entry& getconfig(const config_table&, const char*)");
+    return (entry==0 ? config_table::empty_ : *entry);
+}
+
+
+const config_entry& getconfig(const config_table &conf, const std::string &token)
+{
+    const config_entry *entry=lookupentry(conf, token, "const config_entry& getconfig(const config_table&, const std::string&)");
+    return (entry==0 ? config_table::empty_ : *entry);
+}
+
+
+const config_entry& getconfig(const config_layers &conf, const std::string &token)
+{
+    const config_entry *entry=lookupentry(conf, token, "const config_entry& getconfig(const config_layers&, const std::string&)");
+    return (entry==0 ? config_layers::empty_ : *entry);
+}
+
+
+const config_entry& getconfig(const config_pool &conf, const char *token)
+{
+    const config_entry *entry=lookupentry(conf, token, "const config_entry& getconfig(const config_pool&, const char*)");
+    return (entry==0 ? config_pool::empty_ : *entry);
+}
+
+
+const config_entry& getconfig(const config_pool &conf, const std::string &token)
+{
+    const config_entry *entry=lookupentry(conf, token, "const config_entry& getconfig(const config_pool&, const std::string&)");
+    return (entry==0 ? config_pool::empty_ : *entry);
+}
+
+
+config_entry getconfig(std::istream &in, const std::string &token)
+{
+    config conf(in);
+    return getconfig(conf, token);
+}
+
+
+config_entry getconfig(const std::string &filename, const std::string &token)
+{
+    std::shared_ptr<const config> conf=getcachedconfig(filename);
+    const config_entry *entry=lookupentry(*conf, token, "config_entry getconfig(const std::string&, const std::string&)");
+    return (entry==0 ? config_entry() : *entry);
+}
+
+
+//////////////////// Implementation of freezeconfig function //////////
+
+
+std::shared_ptr<const config_table> freezeconfig(const config &conf)
+{
+    return std::make_shared<const config_table>(conf);
+}
+
+
+//////////////////// Implementation of the config file cache ///////////
+
+
+// A cached config file, with the identity of the parsed version:
+struct cachedconfig
+{
+    time_t mtime_sec_;
+    long mtime_nsec_;
+    off_t size_;
+    std::shared_ptr<const config> conf_;
+};
+
+
+static std::mutex& configcachemutex()
+{
+    static std::mutex mutex;
+    return mutex;
+}
+
+
+static std::map< std::string, cachedconfig >& configcache()
+{
+    static std::map< std::string, cachedconfig > cache;
+    return cache;
+}
+
+
+std::shared_ptr<const config> getcachedconfig(const std::string &filename)
+{
+    std::string path;
+    struct stat st;
+    char *canonical=0;
+    if ( std::isinpipe(filename, path)!=0 || ::stat(path.c_str(), &st)!=0 || !S_ISREG(st.st_mode) || (canonical=::realpath(path.c_str(), 0))==0 )
+    {
+	return std::make_shared<const config>(filename);
+    }
+    const std::string key(canonical);
+    ::free(canonical);
+    {
+	std::lock_guard<std::mutex> lock(configcachemutex());
+	std::map< std::string, cachedconfig >::const_iterator it=configcache().find(key);
+	if ( it!=configcache().end() && it->second.mtime_sec_==st.st_mtim.tv_sec && it->second.mtime_nsec_==st.st_mtim.tv_nsec && it->second.size_==st.st_size )
+	{
+	    return it->second.conf_;
+	}
+    }
+    // Parse outside of the lock, so that other files are not blocked:
+    cachedconfig entry;
+    entry.mtime_sec_=st.st_mtim.tv_sec;
+    entry.mtime_nsec_=st.st_mtim.tv_nsec;
+    entry.size_=st.st_size;
+    entry.conf_=std::make_shared<const config>(key);
+    std::lock_guard<std::mutex> lock(configcachemutex());
+    configcache()[key]=entry;
+    return entry.conf_;
+}
+
+
+void clearconfigcache()
+{
+    std::lock_guard<std::mutex> lock(configcachemutex());
+    configcache().clear();
+}
+
+
+//////////////////// Implementation of filenumbering function //////////
+
+
+std::string filenumbering(const unsigned int no, const unsigned int maxno)
+{
+    int ndigits=(no!=0 ? (int)(::log10((double)no))+1 : 1);
+    int ndigitsmax=(maxno!=0 ? (int)(::log10((double)maxno))+1 : 1);
+    std::ostringstream oss;
+    for ( int i=0 ; i<(int)ndigitsmax-(int)ndigits ; ++i ) oss<<"0";
+    oss<<no;
+    return oss.str();
+}
+
+
+//////////////////// Implementation of getrevision function ////////////
+
+
+#ifndef REVISIONSTRING
+#define REVISIONSTRING "unknown"
+#endif
+std::string getrevision()
+{
+    return std::string(REVISIONSTRING);
+}
+
+
+//////////////////// Implementation of getresultsdir function /////////
+
+
+std::string getresultsdir(const std::string &defaulttag)
+{
+    const char *tag=std::getenv("PREFIX_TAG");
+    if ( tag==0 || *tag==0 ) tag=std::getenv("TAG");
+    const std::string dir=std::string("results/")+(tag!=0 && *tag!=0 ? tag : defaulttag.c_str());
+    if ( (::mkdir("results", 0755)!=0 && errno!=EEXIST) || (::mkdir(dir.c_str(), 0755)!=0 && errno!=EEXIST) )
+    {
+	std::cerr<<"[config] Could not create directory "<<dir<<" !\n[config]\tstd::string getresultsdir(const std::string&)\n";
+    }
+    return dir;
+}
+
+
+//////////////////// Implementation of gettime function ////////////////
+
+
+unsigned int gettime()
+{
+    time_t TIME;
+    time(&TIME);
+    return (unsigned int)TIME;
+}
+
+
+//////////////////// Implementation of gettime_hr function /////////////
+
+
+std::string gettime_hr()
+{
+    time_t TIME;
+    char chartime[32];
+    time(&TIME);
+    ctime_r(&TIME, chartime);
+    return std::string(chartime);
+}
+
+
+//////////////////// Implementation of getusertime function ////////////
+
+
+unsigned int getusertime()
+{
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec;
+}
+
+
+//////////////////// Implementation of getcputime function /////////////
+
+
+unsigned int getcputime()
+{
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_stime.tv_sec;
+}
+
+
+//////////////////// Implementation of nanosecond clocks //////////////
+
+
+static inline unsigned long long getclock_ns(const clockid_t clock)
+{
+    timespec ts;
+    clock_gettime(clock, &ts);
+    return (unsigned long long)ts.tv_sec*1000000000ULL+ts.tv_nsec;
+}
+
+
+unsigned long long gettime_ns()
+{
+    return getclock_ns(CLOCK_MONOTONIC);
+}
+
+
+unsigned long long getcputime_ns()
+{
+    return getclock_ns(CLOCK_PROCESS_CPUTIME_ID);
+}
+
+
+unsigned long long getthreadtime_ns()
+{
+    return getclock_ns(CLOCK_THREAD_CPUTIME_ID);
+}
+
+
+// Calibration of the time stamp counter against CLOCK_MONOTONIC:
+struct tsccalibration
+{
+    bool available_;
+    unsigned long long tick0_;
+    unsigned long long ns0_;
+    double nspertick_;
+};
+
+
+// Reference point of the calibration, taken at static initialization 
+// (without waiting), so that the rate can later be measured over the 
+// time since then:
+static const tsccalibration& gettscreference()
+{
+    static const tsccalibration c=[]() {
+	tsccalibration r={ false, 0, 0, 0.0 };
+#if defined(__x86_64__) || defined(__i386__)
+	unsigned int eax=0, ebx=0, ecx=0, edx=0;
+	// Invariant TSC (constant rate, not stopped in sleep states):
+	if ( !__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx) || (edx&(1u<<8))==0 ) return r;
+	r.available_=true;
+	r.ns0_=gettime_ns();
+	r.tick0_=__rdtsc();
+#endif
+	return r;
+    }();
+    return c;
+}
+
+
+static const bool tscreferencetaken=(gettscreference(), true);
+
+
+// Measure the rate against the reference point, waiting only if less 
+// than 10 milliseconds passed since it was taken:
+static tsccalibration calibratetsc()
+{
+    tsccalibration c=gettscreference();
+#if defined(__x86_64__) || defined(__i386__)
+    if ( !c.available_ ) return c;
+    const unsigned long long wait=10000000;
+    const unsigned long long elapsed=gettime_ns()-c.ns0_;
+    if ( elapsed<wait )
+    {
+	const timespec sleep={ 0, (long)(wait-elapsed) };
+	nanosleep(&sleep, 0);
+    }
+    const unsigned long long ns1=gettime_ns(), tick1=__rdtsc();
+    if ( tick1<=c.tick0_ || ns1<=c.ns0_ )
+    {
+	c.available_=false;
+	return c;
+    }
+    c.nspertick_=(double)(ns1-c.ns0_)/(double)(tick1-c.tick0_);
+#endif
+    return c;
+}
+
+
+static const tsccalibration& gettsccalibration()
+{
+    static const tsccalibration c=calibratetsc();
+    return c;
+}
+
+
+unsigned long long gettsc_ns()
+{
+    const tsccalibration &c=gettsccalibration();
+#if defined(__x86_64__) || defined(__i386__)
+    if ( c.available_ ) return c.ns0_+(unsigned long long)((double)(__rdtsc()-c.tick0_)*c.nspertick_);
+#endif
+    return gettime_ns();
+}
+
+
+bool tscavailable()
+{
+    return gettscreference().available_;
+}
+
+
+//////////////////// Implementation of class scoped_timer //////////////
+
+
+scoped_timer::slot::slot(const std::string &name)
+ : name_(name), calls_(0), walltime_(0), cputime_(0)
+{
+}
+
+
+const std::string& scoped_timer::slot::name() const
+{
+    return name_;
+}
+
+
+unsigned long long scoped_timer::slot::calls() const
+{
+    return calls_.load(std::memory_order_relaxed);
+}
+
+
+unsigned long long scoped_timer::slot::walltime() const
+{
+    return walltime_.load(std::memory_order_relaxed);
+}
+
+
+unsigned long long scoped_timer::slot::cputime() const
+{
+    return cputime_.load(std::memory_order_relaxed);
+}
+
+
+void scoped_timer::slot::add(const unsigned long long walltime, const unsigned long long cputime)
+{
+    calls_.fetch_add(1, std::memory_order_relaxed);
+    walltime_.fetch_add(walltime, std::memory_order_relaxed);
+    cputime_.fetch_add(cputime, std::memory_order_relaxed);
+}
+
+
+std::mutex& scoped_timer::mutex()
+{
+    static std::mutex *m=new std::mutex;
+    return *m;
+}
+
+
+std::map<std::string, scoped_timer::slot*>& scoped_timer::slots()
+{
+    static std::map<std::string, slot*> *s=new std::map<std::string, slot*>;
+    return *s;
+}
+
+
+unsigned long long scoped_timer::now()
+{
+#ifdef __CONFIG_TSC_TIMERS
+    return gettsc_ns();
+#else
+    return gettime_ns();
+#endif
+}
+
+
+scoped_timer::scoped_timer(slot &s)
+ : slot_(s), wallstart_(now()), cpustart_(getthreadtime_ns())
+{
+}
+
+
+scoped_timer::scoped_timer(const std::string &name)
+ : slot_(getslot(name)), wallstart_(now()), cpustart_(getthreadtime_ns())
+{
+}
+
+
+scoped_timer::~scoped_timer()
+{
+    const unsigned long long cpuend=getthreadtime_ns();
+    slot_.add(elapsed(), cpuend-cpustart_);
+}
+
+
+unsigned long long scoped_timer::elapsed() const
+{
+    const unsigned long long end=now();
+    return (end>wallstart_ ? end-wallstart_ : 0);
+}
+
+
+scoped_timer::slot& scoped_timer::getslot(const std::string &name)
+{
+    std::lock_guard<std::mutex> lock(mutex());
+    slot *&s=slots()[name];
+    if ( s==0 ) s=new slot(name);
+    return *s;
+}
+
+
+void scoped_timer::report(std::ostream &out)
+{
+    std::lock_guard<std::mutex> lock(mutex());
+    std::vector<const slot*> sorted;
+    for ( std::map<std::string, slot*>::const_iterator i=slots().begin() ; i!=slots().end() ; ++i ) if ( i->second->calls()>0 ) sorted.push_back(i->second);
+    if ( sorted.empty() ) return;
+    std::stable_sort(sorted.begin(), sorted.end(), [](const slot *a, const slot *b) { return a->walltime()>b->walltime(); });
+    out<<"Timers (name: calls, wall time, CPU time, mean wall time per call):\n";
+    for ( std::size_t i=0 ; i<sorted.size() ; ++i )
+    {
+	const slot &s=*sorted[i];
+	out<<"  "<<s.name()<<": "<<s.calls()<<", "<<s.walltime()*1.0e-9<<" seconds, "<<s.cputime()*1.0e-9<<" seconds, "<<(double)s.walltime()/s.calls()<<" nanoseconds\n";
+    }
+}
+
+
+void scoped_timer::clear()
+{
+    std::lock_guard<std::mutex> lock(mutex());
+    for ( std::map<std::string, slot*>::iterator i=slots().begin() ; i!=slots().end() ; ++i )
+    {
+	slot &s=*i->second;
+	s.calls_=0;
+	s.walltime_=0;
+	s.cputime_=0;
+    }
+}
+
+
+//////////////////// Implementation of class profile_zone //////////////
+
+
+// A thread calling a task periodically, until stopped. Never 
+// destructed, so that it can be stopped from the destructor of 
+// __summaryinfo. pid_ is the process which started the thread (a 
+// forked child does not have it):
+struct periodicthread
+{
+    std::mutex control_;
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::thread thread_;
+    pid_t pid_;
+    unsigned int interval_;
+    bool stop_;
+    std::function<void()> task_;
+};
+
+
+static void periodicloop(periodicthread *periodic)
+{
+    std::unique_lock<std::mutex> lock(periodic->mutex_);
+    while ( !periodic->stop_ )
+    {
+	lock.unlock();
+	periodic->task_();
+	lock.lock();
+	periodic->wake_.wait_for(lock, std::chrono::milliseconds(periodic->interval_), [periodic]() { return periodic->stop_; });
+    }
+}
+
+
+// (Re)start a periodic thread with the given interval (0 stops it):
+static void startperiodic(periodicthread &periodic, const unsigned int milliseconds, const std::function<void()> &task)
+{
+    std::lock_guard<std::mutex> control(periodic.control_);
+    // The thread of the parent, after a fork, is only forgotten:
+    if ( periodic.thread_.joinable() && periodic.pid_!=::getpid() ) new (&periodic.thread_) std::thread();
+    if ( periodic.thread_.joinable() )
+    {
+	{
+	    std::lock_guard<std::mutex> lock(periodic.mutex_);
+	    periodic.stop_=true;
+	}
+	periodic.wake_.notify_all();
+	periodic.thread_.join();
+    }
+    if ( milliseconds==0 ) return;
+    periodic.interval_=milliseconds;
+    periodic.stop_=false;
+    periodic.task_=task;
+    periodic.pid_=::getpid();
+    periodic.thread_=std::thread(periodicloop, &periodic);
+}
+
+
+// Aggregated zones: tree of the zone call paths of all threads. Never 
+// destroyed, so that it is still there when the summary is written:
+struct zonetree
+{
+    struct node
+    {
+	unsigned int site_;
+	std::size_t parent_;
+	unsigned long long calls_;
+	unsigned long long inclusive_;
+	unsigned long long children_;
+    };
+    std::mutex mutex_;
+    /// Trace events (see profile_zone::trace):
+    struct zoneevent
+    {
+	unsigned long long begin_;
+	unsigned long long duration_;
+	unsigned int site_;
+	pid_t tid_;
+    };
+    struct memoryevent
+    {
+	unsigned long long time_;
+	unsigned long long size_;
+	unsigned long long resident_;
+    };
+    std::vector<std::string> sites_;
+    std::vector<profile_zone::buffer*> buffers_;
+    /// Buffers of exited threads, for reuse:
+    std::vector<profile_zone::buffer*> free_;
+    /// Zones left open by exited threads (count per site):
+    std::map<unsigned int, unsigned long long> openzones_;
+    /// Records dropped by exited threads, as their buffer was full:
+    unsigned long long overflows_;
+    std::map<pid_t, std::string> threadnames_;
+    std::atomic<bool> tracing_;
+    std::string tracefile_;
+    std::size_t maxevents_;
+    unsigned long long dropped_;
+    std::deque<zoneevent> zoneevents_;
+    std::deque<memoryevent> memoryevents_;
+    /// Node 0 is the root:
+    std::vector<node> nodes_;
+    std::map<std::pair<std::size_t, unsigned int>, std::size_t> children_;
+    zonetree() : overflows_(0), tracing_(false), maxevents_(0), dropped_(0), nodes_(1, node()) {}
+};
+
+
+static zonetree& getzonetree()
+{
+    static zonetree *tree=new zonetree();
+    return *tree;
+}
+
+
+// Open zones of a buffer (node in the tree, entering time):
+struct profile_zone::buffer::state
+{
+    std::vector< std::pair<std::size_t, unsigned long long> > stack_;
+    /// The last looked up child (zones are mostly entered repeatedly 
+    /// from the same parent), valid if node_!=0:
+    std::size_t parent_;
+    unsigned int site_;
+    std::size_t node_;
+    state() : stack_(), parent_(0), site_(0), node_(0) {}
+};
+
+
+thread_local profile_zone::buffer* profile_zone::localbuffer_=0;
+
+bool profile_zone::tsc_=false;
+
+
+profile_zone::site::site(const std::string &name)
+ : id_(0)
+{
+    zonetree &tree=getzonetree();
+    std::lock_guard<std::mutex> lock(tree.mutex_);
+    const_cast<unsigned int&>(id_)=tree.sites_.size();
+    tree.sites_.push_back(name);
+}
+
+
+profile_zone::buffer::buffer()
+ : head_(0), tail_(0), skipped_(0), overflows_(0), state_(new state()), tid_(syscall(SYS_gettid))
+{
+}
+
+
+// The collector thread, draining the buffers periodically:
+static periodicthread& getzonecollector()
+{
+    static periodicthread *collector=new periodicthread();
+    return *collector;
+}
+
+
+profile_zone::buffer& profile_zone::newbuffer()
+{
+    // The TSC is only checked here, its rate is measured when the 
+    // records are reported:
+    static const bool started=(tsc_=tscavailable(), startperiodic(getzonecollector(), collectinterval, drainall), true);
+    (void)started;
+    // Retires the buffer when the thread exits:
+    struct retirer
+    {
+	buffer *buffer_;
+	~retirer() { if ( buffer_!=0 ) { profile_zone::retire(*buffer_); localbuffer_=0; } }
+    };
+    static thread_local retirer owner={ 0 };
+    zonetree &tree=getzonetree();
+    buffer *b=0;
+    {
+	std::lock_guard<std::mutex> lock(tree.mutex_);
+	if ( !tree.free_.empty() ) { b=tree.free_.back(); tree.free_.pop_back(); }
+    }
+    if ( b==0 ) b=new buffer();
+    else
+    {
+	std::lock_guard<std::mutex> drainlock(b->drain_);
+	b->tid_=syscall(SYS_gettid);
+	b->skipped_=0;
+    }
+    {
+	std::lock_guard<std::mutex> lock(tree.mutex_);
+	tree.buffers_.push_back(b);
+    }
+    owner.buffer_=b;
+    localbuffer_=b;
+    return *b;
+}
+
+
+void profile_zone::retire(buffer &b)
+{
+    drain(b);
+    zonetree &tree=getzonetree();
+    std::lock_guard<std::mutex> drainlock(b.drain_);
+    std::lock_guard<std::mutex> lock(tree.mutex_);
+    std::vector< std::pair<std::size_t, unsigned long long> > &stack=b.state_->stack_;
+    for ( std::size_t i=0 ; i<stack.size() ; ++i ) ++tree.openzones_[tree.nodes_[stack[i].first].site_];
+    stack.clear();
+    tree.overflows_+=b.overflows_.exchange(0);
+    // Keep the default name of the thread for its trace events:
+    if ( tree.threadnames_.count(b.tid_)==0 )
+    {
+	std::ostringstream name;
+	if ( b.tid_==getpid() ) name<<"main";
+	else name<<"thread "<<b.tid_;
+	tree.threadnames_[b.tid_]=name.str();
+    }
+    tree.buffers_.erase(std::find(tree.buffers_.begin(), tree.buffers_.end(), &b));
+    tree.free_.push_back(&b);
+}
+
+
+void profile_zone::drain(buffer &b)
+{
+    std::lock_guard<std::mutex> drainlock(b.drain_);
+    const std::size_t head=b.head_.load(std::memory_order_acquire);
+    std::size_t tail=b.tail_.load(std::memory_order_relaxed);
+    zonetree &tree=getzonetree();
+    std::lock_guard<std::mutex> lock(tree.mutex_);
+    std::vector< std::pair<std::size_t, unsigned long long> > &stack=b.state_->stack_;
+    for ( ; tail!=head ; ++tail )
+    {
+	const record &r=b.records_[tail&(buffer::capacity-1)];
+	if ( r.enter_ )
+	{
+	    const std::size_t parent=(stack.empty() ? 0 : stack.back().first);
+	    buffer::state &cache=*b.state_;
+	    if ( cache.node_==0 || cache.parent_!=parent || cache.site_!=r.site_ )
+	    {
+		std::map<std::pair<std::size_t, unsigned int>, std::size_t>::iterator i=tree.children_.find(std::make_pair(parent, r.site_));
+		if ( i==tree.children_.end() )
+		{
+		    const zonetree::node n={ r.site_, parent, 0, 0, 0 };
+		    tree.nodes_.push_back(n);
+		    i=tree.children_.insert(std::make_pair(std::make_pair(parent, r.site_), tree.nodes_.size()-1)).first;
+		}
+		cache.parent_=parent;
+		cache.site_=r.site_;
+		cache.node_=i->second;
+	    }
+	    stack.push_back(std::make_pair(cache.node_, r.time_));
+	}
+	else if ( !stack.empty() && tree.nodes_[stack.back().first].site_==r.site_ )
+	{
+	    zonetree::node &n=tree.nodes_[stack.back().first];
+	    const unsigned long long duration=(r.time_>stack.back().second ? r.time_-stack.back().second : 0);
+	    ++n.calls_;
+	    n.inclusive_+=duration;
+	    tree.nodes_[n.parent_].children_+=duration;
+	    if ( tree.tracing_.load(std::memory_order_relaxed) )
+	    {
+		const zonetree::zoneevent e={ stack.back().second, duration, r.site_, b.tid_ };
+		tree.zoneevents_.push_back(e);
+		if ( tree.zoneevents_.size()>tree.maxevents_ ) { tree.zoneevents_.pop_front(); ++tree.dropped_; }
+	    }
+	    stack.pop_back();
+	}
+    }
+    b.tail_.store(tail, std::memory_order_release);
+}
+
+
+// Write a node of the zone tree and its children, longest first:
+static void reportzone(std::ostream &out, const zonetree &tree, const std::vector< std::vector<std::size_t> > &children, const std::size_t index, const unsigned int depth, const double nspertick)
+{
+    const zonetree::node &n=tree.nodes_[index];
+    if ( index!=0 )
+    {
+	const unsigned long long exclusive=(n.inclusive_>n.children_ ? n.inclusive_-n.children_ : 0);
+	out<<std::string(2*depth, ' ')<<tree.sites_[n.site_]<<": "<<n.inclusive_*nspertick*1.0e-9<<" seconds, "<<exclusive*nspertick*1.0e-9<<" seconds, "<<n.calls_<<"\n";
+    }
+    std::vector<std::size_t> sorted=children[index];
+    std::stable_sort(sorted.begin(), sorted.end(), [&tree](const std::size_t a, const std::size_t b) { return tree.nodes_[a].inclusive_>tree.nodes_[b].inclusive_; });
+    for ( std::size_t i=0 ; i<sorted.size() ; ++i ) reportzone(out, tree, children, sorted[i], depth+1, nspertick);
+}
+
+
+void profile_zone::drainall()
+{
+    zonetree &tree=getzonetree();
+    std::vector<buffer*> buffers;
+    {
+	std::lock_guard<std::mutex> lock(tree.mutex_);
+	buffers=tree.buffers_;
+    }
+    for ( std::size_t i=0 ; i<buffers.size() ; ++i ) drain(*buffers[i]);
+}
+
+
+void profile_zone::report(std::ostream &out)
+{
+    drainall();
+    zonetree &tree=getzonetree();
+    std::lock_guard<std::mutex> lock(tree.mutex_);
+    if ( tree.nodes_.size()<=1 ) return;
+    std::vector< std::vector<std::size_t> > children(tree.nodes_.size());
+    for ( std::size_t i=1 ; i<tree.nodes_.size() ; ++i ) if ( tree.nodes_[i].calls_>0 ) children[tree.nodes_[i].parent_].push_back(i);
+    const double nspertick=(tsc_ ? gettsccalibration().nspertick_ : 1.0);
+    out<<"Profiling zones (zone: inclusive time, exclusive time, calls):\n";
+    reportzone(out, tree, children, 0, 0, nspertick);
+    unsigned long long overflows=tree.overflows_;
+    for ( std::size_t i=0 ; i<tree.buffers_.size() ; ++i ) overflows+=tree.buffers_[i]->overflows_.load(std::memory_order_relaxed);
+    if ( overflows>0 ) out<<"Zone records dropped (buffer full): "<<overflows<<"\n";
+    // Zones left open by exited threads, or still open in running ones:
+    std::map<unsigned int, unsigned long long> open=tree.openzones_;
+    for ( std::size_t i=0 ; i<tree.buffers_.size() ; ++i )
+    {
+	const std::vector< std::pair<std::size_t, unsigned long long> > &stack=tree.buffers_[i]->state_->stack_;
+	for ( std::size_t j=0 ; j<stack.size() ; ++j ) ++open[tree.nodes_[stack[j].first].site_];
+    }
+    if ( open.empty() ) return;
+    out<<"Zones still open (zone: count):\n";
+    for ( std::map<unsigned int, unsigned long long>::const_iterator i=open.begin() ; i!=open.end() ; ++i ) out<<"  "<<tree.sites_[i->first]<<": "<<i->second<<"\n";
+}
+
+
+void profile_zone::threadname(const std::string &name)
+{
+    zonetree &tree=getzonetree();
+    std::lock_guard<std::mutex> lock(tree.mutex_);
+    tree.threadnames_[syscall(SYS_gettid)]=name;
+}
+
+
+void profile_zone::trace(const std::string &filename, const std::size_t maxevents)
+{
+    zonetree &tree=getzonetree();
+    std::lock_guard<std::mutex> lock(tree.mutex_);
+    tree.tracefile_=filename;
+    tree.maxevents_=(maxevents>0 ? maxevents : 1);
+    tree.tracing_=true;
+}
+
+
+void profile_zone::tracememory(const unsigned long long size, const unsigned long long resident)
+{
+    zonetree &tree=getzonetree();
+    if ( !tree.tracing_.load(std::memory_order_relaxed) ) return;
+    const zonetree::memoryevent e={ gettime_ns(), size, resident };
+    std::lock_guard<std::mutex> lock(tree.mutex_);
+    tree.memoryevents_.push_back(e);
+    if ( tree.memoryevents_.size()>tree.maxevents_ ) { tree.memoryevents_.pop_front(); ++tree.dropped_; }
+}
+
+
+// Write a string as JSON string:
+static void writejson(std::ostream &out, const std::string &str)
+{
+    out<<'"';
+    for ( std::size_t i=0 ; i<str.length() ; ++i )
+    {
+	const unsigned char c=str[i];
+	if ( c=='"' || c=='\\' ) out<<'\\'<<c;
+	else if ( c<0x20 ) { char buff[8]; std::snprintf(buff, sizeof(buff), "\\u%04x", c); out<<buff; }
+	else out<<c;
+    }
+    out<<'"';
+}
+
+
+bool profile_zone::writetrace()
+{
+    zonetree &tree=getzonetree();
+    if ( !tree.tracing_ ) return true;
+    drainall();
+    std::lock_guard<std::mutex> lock(tree.mutex_);
+    const std::string filename=(tree.tracefile_.empty() ? getresultsdir()+"/trace.json" : tree.tracefile_);
+    std::ofstream file(filename.c_str());
+    const pid_t pid=getpid();
+    // The zone times are in ticks of now(), the trace is in microseconds:
+    const tsccalibration &c=gettsccalibration();
+    const bool tsc=tsc_;
+    file.precision(3);
+    file<<std::fixed;
+    file<<"{\"traceEvents\":[\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":"<<pid<<",\"tid\":"<<pid<<",\"args\":{\"name\":";
+    writejson(file, program_invocation_short_name);
+    file<<"}}";
+    std::map<pid_t, std::string> names=tree.threadnames_;
+    for ( std::size_t i=0 ; i<tree.buffers_.size() ; ++i )
+    {
+	const pid_t tid=tree.buffers_[i]->tid_;
+	if ( names.count(tid)==0 )
+	{
+	    std::ostringstream name;
+	    if ( tid==pid ) name<<"main";
+	    else name<<"thread "<<tid;
+	    names[tid]=name.str();
+	}
+    }
+    for ( std::map<pid_t, std::string>::const_iterator i=names.begin() ; i!=names.end() ; ++i )
+    {
+	file<<",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":"<<pid<<",\"tid\":"<<i->first<<",\"args\":{\"name\":";
+	writejson(file, i->second);
+	file<<"}}";
+    }
+    for ( std::deque<zonetree::zoneevent>::const_iterator i=tree.zoneevents_.begin() ; i!=tree.zoneevents_.end() ; ++i )
+    {
+	const double begin=(tsc ? c.ns0_+(double)(long long)(i->begin_-c.tick0_)*c.nspertick_ : (double)i->begin_);
+	const double duration=(tsc ? i->duration_*c.nspertick_ : (double)i->duration_);
+	file<<",\n{\"name\":";
+	writejson(file, tree.sites_[i->site_]);
+	file<<",\"cat\":\"zone\",\"ph\":\"X\",\"ts\":"<<begin*1.0e-3<<",\"dur\":"<<duration*1.0e-3<<",\"pid\":"<<pid<<",\"tid\":"<<i->tid_<<"}";
+    }
+    for ( std::deque<zonetree::memoryevent>::const_iterator i=tree.memoryevents_.begin() ; i!=tree.memoryevents_.end() ; ++i )
+    {
+	file<<",\n{\"name\":\"memory\",\"ph\":\"C\",\"ts\":"<<i->time_*1.0e-3<<",\"pid\":"<<pid<<",\"args\":{\"resident MB\":"<<i->resident_/1048576.0<<",\"virtual MB\":"<<i->size_/1048576.0<<"}}";
+    }
+    file<<"\n],\"displayTimeUnit\":\"ms\",\"otherData\":{\"droppedEvents\":"<<tree.dropped_<<"}}\n";
+    if ( !file )
+    {
+	std::cerr<<"[config] Could not write trace file "<<filename<<" !\n[config]\tbool profile_zone::writetrace()\n";
+	return false;
+    }
+    return true;
+}
+
+
+static const bool traceenabled=(std::getenv("PROFILE_TRACE")!=0 && *std::getenv("PROFILE_TRACE")!=0 ? (profile_zone::trace(std::string(std::getenv("PROFILE_TRACE"))=="1" ? "" : std::getenv("PROFILE_TRACE")), true) : false);
+
+
+//////////////////// Implementation of class perf_counters /////////////
+
+
+// Type and config of the counters:
+static const unsigned int perftypes[perf_counters::ncounters]={ PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_SOFTWARE, PERF_TYPE_SOFTWARE };
+
+static const unsigned long long perfconfigs[perf_counters::ncounters]={ PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES, PERF_COUNT_SW_PAGE_FAULTS, PERF_COUNT_SW_CONTEXT_SWITCHES };
+
+static const char* const perfnames[perf_counters::ncounters]={ "cycles", "instructions", "cache misses", "branch misses", "page faults", "context switches" };
+
+
+// Counter group of a thread, read with a single read:
+struct perfgroup
+{
+    bool opened_;
+    int leader_;
+    int fds_[perf_counters::ncounters];
+    /// Position of the counters in the group reading (-1 if not open):
+    int index_[perf_counters::ncounters];
+    int n_;
+    perfgroup();
+    ~perfgroup();
+};
+
+
+perfgroup::perfgroup()
+ : opened_(false), leader_(-1), n_(0)
+{
+    for ( unsigned int c=0 ; c<perf_counters::ncounters ; ++c )
+    {
+	fds_[c]=-1;
+	index_[c]=-1;
+    }
+}
+
+
+perfgroup::~perfgroup()
+{
+    for ( unsigned int c=0 ; c<perf_counters::ncounters ; ++c ) if ( fds_[c]>=0 ) ::close(fds_[c]);
+}
+
+
+// Counts scaled up for the time the counter was not scheduled:
+static unsigned long long perfscale(const unsigned long long value, const unsigned long long enabled, const unsigned long long running)
+{
+    if ( running==0 ) return 0;
+    if ( running>=enabled ) return value;
+    return (unsigned long long)((double)value*enabled/running);
+}
+
+
+// Values from getrusage, where perf_event_open is not available:
+static void rusagevalues(perf_counters::values &v, const int who)
+{
+    rusage usage;
+    getrusage(who, &usage);
+    v.value_[perf_counters::pagefaults]=usage.ru_minflt+usage.ru_majflt;
+    v.valid_[perf_counters::pagefaults]=true;
+    v.value_[perf_counters::contextswitches]=usage.ru_nvcsw+usage.ru_nivcsw;
+    v.valid_[perf_counters::contextswitches]=true;
+}
+
+
+int perf_counters::runfds_[ncounters]={ -1, -1, -1, -1, -1, -1 };
+
+perf_counters::values perf_counters::runstart_;
+
+
+int perf_counters::open(const counter c, const int group, const bool inherit)
+{
+    perf_event_attr attr;
+    std::memset(&attr, 0, sizeof(attr));
+    attr.size=sizeof(attr);
+    attr.type=perftypes[c];
+    attr.config=perfconfigs[c];
+    // Context switches and page faults happen in the kernel:
+    attr.exclude_kernel=(perftypes[c]==PERF_TYPE_HARDWARE);
+    attr.exclude_hv=1;
+    attr.inherit=inherit;
+    attr.read_format=PERF_FORMAT_TOTAL_TIME_ENABLED|PERF_FORMAT_TOTAL_TIME_RUNNING|(inherit ? 0 : PERF_FORMAT_GROUP);
+    return syscall(SYS_perf_event_open, &attr, 0, -1, group, PERF_FLAG_FD_CLOEXEC);
+}
+
+
+void perf_counters::read(values &v)
+{
+    static thread_local perfgroup group;
+    if ( !group.opened_ )
+    {
+	group.opened_=true;
+	for ( unsigned int c=0 ; c<ncounters ; ++c )
+	{
+	    const int fd=open((counter)c, group.leader_, false);
+	    if ( fd<0 ) continue;
+	    if ( group.leader_<0 ) group.leader_=fd;
+	    group.fds_[c]=fd;
+	    group.index_[c]=group.n_++;
+	}
+    }
+    for ( unsigned int c=0 ; c<ncounters ; ++c )
+    {
+	v.value_[c]=0;
+	v.valid_[c]=false;
+    }
+    if ( group.leader_<0 )
+    {
+	rusagevalues(v, RUSAGE_THREAD);
+	return;
+    }
+    // Group reading: number of counters, enabled time, running time, values:
+    unsigned long long buff[3+ncounters];
+    if ( ::read(group.leader_, buff, sizeof(buff))<(ssize_t)((3+group.n_)*sizeof(unsigned long long)) ) return;
+    for ( unsigned int c=0 ; c<ncounters ; ++c )
+    {
+	if ( group.index_[c]<0 ) continue;
+	v.value_[c]=perfscale(buff[3+group.index_[c]], buff[1], buff[2]);
+	v.valid_[c]=true;
+    }
+}
+
+
+bool perf_counters::readrun(values &v)
+{
+    std::lock_guard<std::mutex> lock(mutex());
+    bool enabled=false, open=false;
+    for ( unsigned int c=0 ; c<ncounters ; ++c )
+    {
+	v.value_[c]=0;
+	v.valid_[c]=runstart_.valid_[c];
+	enabled=enabled || runstart_.valid_[c];
+	if ( runfds_[c]<0 ) continue;
+	open=true;
+	// Single reading: value, enabled time, running time:
+	unsigned long long buff[3];
+	if ( ::read(runfds_[c], buff, sizeof(buff))!=(ssize_t)sizeof(buff) ) { v.valid_[c]=false; continue; }
+	v.value_[c]=perfscale(buff[0], buff[1], buff[2]);
+    }
+    if ( enabled && !open )
+    {
+	rusagevalues(v, RUSAGE_SELF);
+	for ( unsigned int c=0 ; c<ncounters ; ++c ) if ( v.valid_[c] ) v.value_[c]-=runstart_.value_[c];
+    }
+    return enabled;
+}
+
+
+void perf_counters::enable()
+{
+    std::lock_guard<std::mutex> lock(mutex());
+    for ( unsigned int c=0 ; c<ncounters ; ++c ) if ( runstart_.valid_[c] ) return;
+    bool open=false;
+    for ( unsigned int c=0 ; c<ncounters ; ++c )
+    {
+	runfds_[c]=perf_counters::open((counter)c, -1, true);
+	runstart_.value_[c]=0;
+	runstart_.valid_[c]=(runfds_[c]>=0);
+	open=open || runfds_[c]>=0;
+    }
+    if ( !open ) rusagevalues(runstart_, RUSAGE_SELF);
+}
+
+
+std::mutex& perf_counters::mutex()
+{
+    static std::mutex *m=new std::mutex;
+    return *m;
+}
+
+
+std::map<std::string, perf_counters::slot*>& perf_counters::slots()
+{
+    static std::map<std::string, slot*> *s=new std::map<std::string, slot*>;
+    return *s;
+}
+
+
+perf_counters::slot::slot(const std::string &name)
+ : name_(name), calls_(0)
+{
+    for ( unsigned int c=0 ; c<ncounters ; ++c )
+    {
+	values_.value_[c]=0;
+	values_.valid_[c]=true;
+    }
+}
+
+
+const std::string& perf_counters::slot::name() const
+{
+    return name_;
+}
+
+
+void perf_counters::slot::add(const values &start, const values &end)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    ++calls_;
+    for ( unsigned int c=0 ; c<ncounters ; ++c )
+    {
+	values_.valid_[c]=values_.valid_[c] && start.valid_[c] && end.valid_[c];
+	if ( values_.valid_[c] && end.value_[c]>start.value_[c] ) values_.value_[c]+=end.value_[c]-start.value_[c];
+    }
+}
+
+
+perf_counters::values perf_counters::slot::get(unsigned long long &calls)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    calls=calls_;
+    return values_;
+}
+
+
+perf_counters::scope::scope(slot &s)
+ : slot_(s)
+{
+    read(start_);
+}
+
+
+perf_counters::scope::scope(const std::string &name)
+ : slot_(getslot(name))
+{
+    read(start_);
+}
+
+
+perf_counters::scope::~scope()
+{
+    values end;
+    read(end);
+    slot_.add(start_, end);
+}
+
+
+perf_counters::slot& perf_counters::getslot(const std::string &name)
+{
+    std::lock_guard<std::mutex> lock(mutex());
+    slot *&s=slots()[name];
+    if ( s==0 ) s=new slot(name);
+    return *s;
+}
+
+
+void perf_counters::write(std::ostream &out, const values &v)
+{
+    bool first=true;
+    for ( unsigned int c=0 ; c<ncounters ; ++c )
+    {
+	if ( !v.valid_[c] ) continue;
+	out<<(first ? "" : ", ")<<v.value_[c]<<" "<<perfnames[c];
+	first=false;
+    }
+    if ( first ) out<<"no counters available";
+    if ( v.valid_[cycles] && v.valid_[instructions] && v.value_[cycles]>0 ) out<<", IPC "<<(double)v.value_[instructions]/v.value_[cycles];
+    if ( v.valid_[instructions] && v.value_[instructions]>0 )
+    {
+	if ( v.valid_[cachemisses] ) out<<", "<<1000.0*v.value_[cachemisses]/v.value_[instructions]<<" cache misses/kinstruction";
+	if ( v.valid_[branchmisses] ) out<<", "<<1000.0*v.value_[branchmisses]/v.value_[instructions]<<" branch misses/kinstruction";
+    }
+    out<<"\n";
+}
+
+
+void perf_counters::report(std::ostream &out)
+{
+    values run;
+    const bool enabled=readrun(run);
+    std::vector<slot*> sorted;
+    {
+	std::lock_guard<std::mutex> lock(mutex());
+	for ( std::map<std::string, slot*>::const_iterator i=slots().begin() ; i!=slots().end() ; ++i ) sorted.push_back(i->second);
+    }
+    if ( !enabled && sorted.empty() ) return;
+    out<<"Performance counters:\n";
+    if ( enabled )
+    {
+	out<<"  whole run: ";
+	write(out, run);
+    }
+    for ( std::size_t i=0 ; i<sorted.size() ; ++i )
+    {
+	unsigned long long calls=0;
+	const values v=sorted[i]->get(calls);
+	if ( calls==0 ) continue;
+	out<<"  "<<sorted[i]->name()<<" ("<<calls<<" calls): ";
+	write(out, v);
+    }
+}
+
+
+static const bool perfcountersenabled=(std::getenv("PERF_COUNTERS")!=0 && *std::getenv("PERF_COUNTERS")!=0 ? (perf_counters::enable(), true) : false);
+
+
+//////////////////// Implementation of getmem function ////////////////
+
+
+// Descriptors of /proc/self files, kept open, so that reading them is a 
+// single pread (-2 when not opened yet). /proc/self is resolved when a 
+// file is opened, so a forked child closes the descriptors it inherited 
+// (see closeprocfds), and reopens them on first use:
+enum procfile { proc_statm, proc_status, proc_smaps_rollup, proc_io, proc_files };
+
+static std::atomic<int> procfds[proc_files]={ {-2}, {-2}, {-2}, {-2} };
+
+
+static void closeprocfds()
+{
+    for ( unsigned int i=0 ; i<proc_files ; ++i )
+    {
+	const int fd=procfds[i].exchange(-2);
+	if ( fd>=0 ) ::close(fd);
+    }
+}
+
+
+static int procfd(const procfile file)
+{
+    static const bool atfork=(::pthread_atfork(0, 0, closeprocfds)==0);
+    (void)atfork;
+    int fd=procfds[file].load(std::memory_order_acquire);
+    if ( fd!=-2 ) return fd;
+    static const char* const names[proc_files]={ "/proc/self/statm", "/proc/self/status", "/proc/self/smaps_rollup", "/proc/self/io" };
+    const int opened=::open(names[file], O_RDONLY|O_CLOEXEC);
+    if ( procfds[file].compare_exchange_strong(fd, opened) ) return opened;
+    // Opened concurrently by another thread:
+    if ( opened>=0 ) ::close(opened);
+    return fd;
+}
+
+
+// Read a /proc file from the beginning into a 0 terminated buffer:
+static ssize_t preadproc(const int fd, char *buff, const std::size_t size)
+{
+    const ssize_t n=(fd<0 ? -1 : ::pread(fd, buff, size-1, 0));
+    buff[n>0 ? n : 0]=0;
+    return n;
+}
+
+
+// Parse the given keys of a /proc file with "Key: <value>" lines, 
+// multiplying the values by the given unit (values of keys not present 
+// are left alone):
+static void parseproc(const char *buff, const char* const *keys, unsigned long long* const *values, const unsigned int nkeys, const unsigned long long unit)
+{
+    for ( const char *line=buff ; *line!=0 ; )
+    {
+	const char *colon=line;
+	while ( *colon!=0 && *colon!=':' && *colon!='\n' ) ++colon;
+	if ( *colon==':' )
+	{
+	    const std::size_t length=colon-line;
+	    for ( unsigned int k=0 ; k<nkeys ; ++k )
+	    {
+		if ( std::strncmp(keys[k], line, length)!=0 || keys[k][length]!=0 ) continue;
+		*values[k]=std::strtoull(colon+1, 0, 10)*unit;
+		break;
+	    }
+	}
+	const char *next=std::strchr(colon, '\n');
+	if ( next==0 ) break;
+	line=next+1;
+    }
+}
+
+
+// Read the program size, the resident set size and the shared (file 
+// and shmem) resident size in bytes:
+static bool readstatm(unsigned long long &size, unsigned long long &resident, unsigned long long &shared)
+{
+    static const unsigned long long pagesize=::sysconf(_SC_PAGESIZE);
+    char buff[128];
+    if ( preadproc(procfd(proc_statm), buff, sizeof(buff))<=0 ) return false;
+    char *end=0;
+    const char *begin=buff;
+    unsigned long long *values[]={ &size, &resident, &shared };
+    for ( unsigned int i=0 ; i<3 ; ++i )
+    {
+	*values[i]=std::strtoull(begin, &end, 10)*pagesize;
+	if ( end==begin ) return false;
+	begin=end;
+    }
+    return true;
+}
+
+
+static bool readstatm(unsigned long long &size, unsigned long long &resident)
+{
+    unsigned long long shared=0;
+    return readstatm(size, resident, shared);
+}
+
+
+bool getmemstats(memory_stats &stats, const memory_stats::level level)
+{
+    std::memset(&stats, 0, sizeof(stats));
+    unsigned long long shared=0;
+    if ( !readstatm(stats.size_, stats.resident_, shared) ) return false;
+    stats.anon_=(stats.resident_>shared ? stats.resident_-shared : 0);
+    stats.file_=shared;
+    if ( level==memory_stats::statm ) return true;
+    char buff[4096];
+    if ( preadproc(procfd(proc_status), buff, sizeof(buff))>0 )
+    {
+	unsigned long long hugetlb=0;
+	const char* const keys[]={ "RssAnon", "RssFile", "RssShmem", "VmSwap", "VmHWM", "HugetlbPages" };
+	unsigned long long* const values[]={ &stats.anon_, &stats.file_, &stats.shmem_, &stats.swap_, &stats.peakresident_, &hugetlb };
+	parseproc(buff, keys, values, 6, 1024);
+	stats.hugepages_+=hugetlb;
+    }
+    if ( level==memory_stats::smaps_rollup && preadproc(procfd(proc_smaps_rollup), buff, sizeof(buff))>0 )
+    {
+	unsigned long long anonhuge=0;
+	const char* const keys[]={ "AnonHugePages" };
+	unsigned long long* const values[]={ &anonhuge };
+	parseproc(buff, keys, values, 1, 1024);
+	stats.hugepages_+=anonhuge;
+    }
+    return true;
+}
+
+
+unsigned int getmem()
+{
+    unsigned long long size=0, resident=0;
+    if ( !readstatm(size, resident) )
+    {
+	std::cerr<<"[config] Could not get memory!\n[config]\tunsigned int getmem()\n";
+	return 0;
+    }
+    return size/1048576;
+}
+
+
+//////////////////// Implementation of putlogdata function /////////////
+
+
+void putlogdata(const std::string &filename)
+{
+    std::ostream *logfile=std::openout(filename);
+    if ( !(*logfile) )
+    {
+	std::cerr<<"[config] Could not open logfile "<<filename<<" !\n[config]\tvoid putlogdata(const std::string&, const unsigned int)\n";
+	delete logfile;
+	return;
+    }
+    if ( !((*logfile)<<"Revision: "<<getrevision()<<"\n"<<"Started at: "<<summaryinfo::getstarttime_hr()<<"Running time: "<<getusertime()<<" seconds\n"<<"CPU time: "<<getcputime()<<" seconds\n"<<"Memory usage: "<<getmem()<<" MegaBytes\n"<<"Logged at: "<<gettime_hr()<<std::endl) )
+    {
+	std::cerr<<"[config] Could not write into logfile "<<filename<<" !\n[config]\tvoid putlogdata(const std::string&, const unsigned int)\n";
+	delete logfile;
+	return;
+    }
+    delete logfile;
+}
+
+
+//////////////////// Implementation of class alloc_profile /////////////
+
+
+// Counters (constant initialised, so that they work before the static 
+// initialisation, as malloc is called from the very beginning):
+static std::atomic<unsigned long long> allocationcount(0);
+static std::atomic<unsigned long long> freecount(0);
+static std::atomic<unsigned long long> allocatedbytes(0);
+static std::atomic<long long> livebytes(0);
+static std::atomic<long long> peakbytes(0);
+
+
+// A sampled call stack:
+struct allocstack
+{
+    static const unsigned int depth=12;
+    void *frames_[depth];
+    unsigned int n_;
+    bool operator<(const allocstack &other) const
+    {
+	if ( n_!=other.n_ ) return n_<other.n_;
+	return std::memcmp(frames_, other.frames_, n_*sizeof(void*))<0;
+    }
+};
+
+
+// Sampled allocations of a call stack:
+struct allocsamples
+{
+    unsigned long long samples_;
+    unsigned long long bytes_;
+};
+
+
+static std::mutex& allocsamplemutex()
+{
+    static std::mutex *m=new std::mutex;
+    return *m;
+}
+
+
+static std::map<allocstack, allocsamples>& allocsampletable()
+{
+    static std::map<allocstack, allocsamples> *t=new std::map<allocstack, allocsamples>;
+    return *t;
+}
+
+
+static long long allocsampleinterval()
+{
+    static const long long interval=(std::getenv("ALLOC_SAMPLE_BYTES")!=0 ? std::strtoll(std::getenv("ALLOC_SAMPLE_BYTES"), 0, 10) : 512*1024);
+    return interval;
+}
+
+
+#ifdef __CONFIG_ALLOC_PROFILING
+extern "C"
+{
+    extern void* __libc_malloc(size_t);
+    extern void* __libc_calloc(size_t, size_t);
+    extern void* __libc_realloc(void*, size_t);
+    extern void* __libc_memalign(size_t, size_t);
+    extern void __libc_free(void*);
+}
+
+
+// Set while the calling thread is inside the sampling (which itself 
+// allocates):
+static thread_local bool insampling=false;
+
+// Bytes allocated by the calling thread until its next sample:
+static thread_local long long untilsample=0;
+
+// State of the random generator of the calling thread (0 until its 
+// first allocation):
+static thread_local unsigned long long samplerandom=0;
+
+
+// Distance to the next sample: exponentially distributed with the 
+// interval as mean, so that the samples neither lock onto periodic 
+// allocation patterns nor all fall on the first allocation of each 
+// thread (xorshift generator, seeded per thread):
+static long long nextsample(const long long interval)
+{
+    if ( samplerandom==0 ) samplerandom=(((unsigned long long)syscall(SYS_gettid)<<32)^(unsigned long long)&samplerandom)|1;
+    samplerandom^=samplerandom<<13;
+    samplerandom^=samplerandom>>7;
+    samplerandom^=samplerandom<<17;
+    const double uniform=((samplerandom>>11)+0.5)/9007199254740992.0;
+    return 1+(long long)(-std::log(uniform)*interval);
+}
+
+
+static void __attribute__((noinline)) sampleallocation(const std::size_t size)
+{
+    const long long interval=allocsampleinterval();
+    if ( interval<=0 || insampling ) return;
+    if ( samplerandom==0 ) untilsample=nextsample(interval);
+    untilsample-=size;
+    if ( untilsample>0 ) return;
+    insampling=true;
+    // A sampled allocation stands for the sampling distances it reached 
+    // (each of them the interval on average):
+    unsigned long long intervals=0;
+    for ( ; untilsample<=0 ; ++intervals ) untilsample+=nextsample(interval);
+    allocstack stack;
+    void *frames[allocstack::depth+2];
+    const int n=backtrace(frames, allocstack::depth+2);
+    // Skip sampleallocation and the allocation function:
+    const int skip=std::min(n, 2);
+    stack.n_=n-skip;
+    std::memcpy(stack.frames_, frames+skip, stack.n_*sizeof(void*));
+    {
+	std::lock_guard<std::mutex> lock(allocsamplemutex());
+	allocsamples &samples=allocsampletable()[stack];
+	++samples.samples_;
+	samples.bytes_+=intervals*interval;
+    }
+    insampling=false;
+}
+
+
+static inline __attribute__((always_inline)) void recordallocation(void *p)
+{
+    if ( p==0 ) return;
+    const std::size_t size=malloc_usable_size(p);
+    allocationcount.fetch_add(1, std::memory_order_relaxed);
+    allocatedbytes.fetch_add(size, std::memory_order_relaxed);
+    const long long live=livebytes.fetch_add(size, std::memory_order_relaxed)+size;
+    long long peak=peakbytes.load(std::memory_order_relaxed);
+    while ( peak<live && !peakbytes.compare_exchange_weak(peak, live, std::memory_order_relaxed) ) ;
+    sampleallocation(size);
+}
+
+
+static inline void recordfree(void *p)
+{
+    if ( p==0 ) return;
+    freecount.fetch_add(1, std::memory_order_relaxed);
+    livebytes.fetch_sub(malloc_usable_size(p), std::memory_order_relaxed);
+}
+
+
+extern "C"
+{
+    void* malloc(size_t size)
+    {
+	void *p=__libc_malloc(size);
+	recordallocation(p);
+	return p;
+    }
+
+    void* calloc(size_t n, size_t size)
+    {
+	void *p=__libc_calloc(n, size);
+	recordallocation(p);
+	return p;
+    }
+
+    void* realloc(void *old, size_t size)
+    {
+	if ( old==0 ) return malloc(size);
+	const std::size_t oldsize=malloc_usable_size(old);
+	void *p=__libc_realloc(old, size);
+	if ( p==0 && size!=0 ) return 0;
+	freecount.fetch_add(1, std::memory_order_relaxed);
+	livebytes.fetch_sub(oldsize, std::memory_order_relaxed);
+	recordallocation(p);
+	return p;
+    }
+
+    void* memalign(size_t alignment, size_t size)
+    {
+	void *p=__libc_memalign(alignment, size);
+	recordallocation(p);
+	return p;
+    }
+
+    void* aligned_alloc(size_t alignment, size_t size)
+    {
+	return memalign(alignment, size);
+    }
+
+    int posix_memalign(void **result, size_t alignment, size_t size)
+    {
+	if ( alignment%sizeof(void*)!=0 || (alignment&(alignment-1))!=0 || alignment==0 ) return EINVAL;
+	void *p=memalign(alignment, size);
+	if ( p==0 ) return ENOMEM;
+	*result=p;
+	return 0;
+    }
+
+    void* valloc(size_t size)
+    {
+	return memalign(sysconf(_SC_PAGESIZE), size);
+    }
+
+    void* pvalloc(size_t size)
+    {
+	const size_t pagesize=sysconf(_SC_PAGESIZE);
+	return memalign(pagesize, (size+pagesize-1)/pagesize*pagesize);
+    }
+
+    void free(void *p)
+    {
+	recordfree(p);
+	__libc_free(p);
+    }
+}
+
+
+void* operator new(std::size_t size)
+{
+    while ( true )
+    {
+	void *p=malloc(size ? size : 1);
+	if ( p!=0 ) return p;
+	std::new_handler handler=std::get_new_handler();
+	if ( handler==0 ) throw std::bad_alloc();
+	handler();
+    }
+}
+
+
+void* operator new[](std::size_t size)
+{
+    return operator new(size);
+}
+
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept
+{
+    try { return operator new(size); }
+    catch ( ... ) { return 0; }
+}
+
+
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept
+{
+    return operator new(size, std::nothrow);
+}
+
+
+void operator delete(void *p) noexcept
+{
+    free(p);
+}
+
+
+void operator delete[](void *p) noexcept
+{
+    free(p);
+}
+
+
+void operator delete(void *p, const std::nothrow_t&) noexcept
+{
+    free(p);
+}
+
+
+void operator delete[](void *p, const std::nothrow_t&) noexcept
+{
+    free(p);
+}
+#endif
+
+
+unsigned long long alloc_profile::allocations()
+{
+    return allocationcount.load(std::memory_order_relaxed);
+}
+
+
+unsigned long long alloc_profile::frees()
+{
+    return freecount.load(std::memory_order_relaxed);
+}
+
+
+unsigned long long alloc_profile::bytes()
+{
+    return allocatedbytes.load(std::memory_order_relaxed);
+}
+
+
+unsigned long long alloc_profile::live()
+{
+    const long long live=livebytes.load(std::memory_order_relaxed);
+    return (live>0 ? live : 0);
+}
+
+
+unsigned long long alloc_profile::peak()
+{
+    return peakbytes.load(std::memory_order_relaxed);
+}
+
+
+bool alloc_profile::enabled()
+{
+#ifdef __CONFIG_ALLOC_PROFILING
+    return true;
+#else
+    return false;
+#endif
+}
+
+
+// Name of a code address: demangled function name (with offset) if 
+// known, module and offset otherwise:
+static std::string addressname(void *address)
+{
+    char **symbols=backtrace_symbols(&address, 1);
+    if ( symbols==0 ) return "?";
+    std::string name(symbols[0]);
+    std::free(symbols);
+    // Format: module(function+offset) [address]
+    const std::string::size_type open=name.find('('), plus=name.find('+', open), close=name.find(')', open);
+    if ( open==std::string::npos || plus==std::string::npos || close==std::string::npos || plus==open+1 ) return name;
+    int status=0;
+    char *demangled=abi::__cxa_demangle(name.substr(open+1, plus-open-1).c_str(), 0, 0, &status);
+    if ( demangled==0 ) return name.substr(open+1, close-open-1);
+    const std::string result=std::string(demangled)+name.substr(plus, close-plus);
+    std::free(demangled);
+    return result;
+}
+
+
+void alloc_profile::report(std::ostream &out, const std::size_t ntop)
+{
+    if ( !enabled() ) return;
+    out<<"Allocations: "<<allocations()<<", frees: "<<frees()<<", allocated: "<<bytes()<<" bytes, live: "<<live()<<" bytes, peak live: "<<peak()<<" bytes\n";
+    std::vector< std::pair<allocstack, allocsamples> > sorted;
+    {
+	std::lock_guard<std::mutex> lock(allocsamplemutex());
+	sorted.assign(allocsampletable().begin(), allocsampletable().end());
+    }
+    if ( sorted.empty() ) return;
+    std::stable_sort(sorted.begin(), sorted.end(), [](const std::pair<allocstack, allocsamples> &a, const std::pair<allocstack, allocsamples> &b) { return a.second.bytes_>b.second.bytes_; });
+    out<<"Top allocating call stacks (estimated bytes, samples of "<<allocsampleinterval()<<" bytes):\n";
+    for ( std::size_t i=0 ; i<sorted.size() && i<ntop ; ++i )
     {
-	if ( string_=="inf" ) { longdouble_=1.0/zero; success_=true; }
-	else if ( string_=="-inf" ) { longdouble_=-1.0/zero; success_=true; }
-	else if ( string_=="nan" ) { longdouble_=::sqrtl(minusone); success_=true; }
-	else { longdouble_=0.0; success_=false; }
+	out<<"  "<<sorted[i].second.bytes_<<" bytes, "<<sorted[i].second.samples_<<" samples:\n";
+	for ( unsigned int f=0 ; f<sorted[i].first.n_ ; ++f ) out<<"      "<<addressname(sorted[i].first.frames_[f])<<"\n";
     }
-    else { success_=true; }
-    return *this;
 }
 
 
-config_entry::config_entry(const std::string &str)
- : string_(), longdouble_(0.0), success_(false)
+bool alloc_profile::writereport()
 {
-    reinit(str);
+    if ( !enabled() ) return true;
+    const std::string filename=getresultsdir()+"/allocations.txt";
+    std::ofstream file(filename.c_str());
+    report(file, 100);
+    if ( !file )
+    {
+	std::cerr<<"[config] Could not write allocation report "<<filename<<" !\n[config]\tbool alloc_profile::writereport()\n";
+	return false;
+    }
+    return true;
 }
 
 
-config_entry::~config_entry()
-{
-}
+//////////////////// Implementation of class metrics_recorder //////////
 
 
-config_entry::operator std::string() const
+// State of the recorder (never destructed, see periodicthread):
+struct metricsrecorder
 {
-    return string_;
-}
+    periodicthread thread_;
+    std::mutex mutex_;
+    int fd_;
+    unsigned long long start_;
+    metricsrecorder() : fd_(-1), start_(0) {}
+};
 
 
-config_entry::operator float() const
+static metricsrecorder& getmetricsrecorder()
 {
-    if ( !success_ ) std::cerr<<"[config] Could not interpret entry \""<<string_<<"\" as float.\n[config]\tconfig_entry::operator float() const\n";
-    return (float)longdouble_;
+    static metricsrecorder *recorder=new metricsrecorder();
+    return *recorder;
 }
 
 
-config_entry::operator double() const
+void metrics_recorder::start(const unsigned int milliseconds, const std::string &filename)
 {
-    if ( !success_ ) std::cerr<<"[config] Could not interpret entry \""<<string_<<"\" as double.\n[config]\tconfig_entry::operator double() const\n";
-    return (double)longdouble_;
+    metricsrecorder &recorder=getmetricsrecorder();
+    startperiodic(recorder.thread_, 0, std::function<void()>());
+    {
+	std::lock_guard<std::mutex> lock(recorder.mutex_);
+	if ( recorder.fd_<0 && milliseconds>0 )
+	{
+	    const std::string name=(filename.empty() ? getresultsdir()+"/metrics.csv" : filename);
+	    recorder.fd_=::open(name.c_str(), O_WRONLY|O_CREAT|O_TRUNC|O_APPEND|O_CLOEXEC, 0644);
+	    if ( recorder.fd_<0 )
+	    {
+		std::cerr<<"[config] Could not open metrics file "<<name<<" !\n[config]\tvoid metrics_recorder::start(const unsigned int, const std::string&)\n";
+		return;
+	    }
+	    static const char header[]="time,user,system,resident,minor_faults,major_faults,voluntary_switches,involuntary_switches,read_chars,write_chars,read_bytes,write_bytes\n";
+	    if ( ::write(recorder.fd_, header, sizeof(header)-1)<0 ) std::cerr<<"[config] Could not write metrics file "<<name<<" !\n[config]\tvoid metrics_recorder::start(const unsigned int, const std::string&)\n";
+	    recorder.start_=gettime_ns();
+	}
+    }
+    startperiodic(recorder.thread_, milliseconds, snapshot);
 }
 
 
-config_entry::operator long double() const
+void metrics_recorder::stop()
 {
-    if ( !success_ ) std::cerr<<"[config] Could not interpret entry \""<<string_<<"\" as long double.\n[config]\tconfig_entry::operator long double() const\n";
-    return longdouble_;
+    metricsrecorder &recorder=getmetricsrecorder();
+    startperiodic(recorder.thread_, 0, std::function<void()>());
+    std::lock_guard<std::mutex> lock(recorder.mutex_);
+    if ( recorder.fd_<0 ) return;
+    ::close(recorder.fd_);
+    recorder.fd_=-1;
 }
 
 
-config_entry::operator int() const
+void metrics_recorder::snapshot()
 {
-    if ( !success_ ) std::cerr<<"[config] Could not interpret entry \""<<string_<<"\" as int.\n[config]\tconfig_entry::operator int() const\n";
-    const int result=(int)longdouble_;
-    if ( (long double)result!=longdouble_ ) std::cerr<<"[config] Problems while interpreting entry \""<<string_<<"\" as int.\n[config]\tconfig_entry::operator int() const\n";
-    return result;
+    metricsrecorder &recorder=getmetricsrecorder();
+    std::lock_guard<std::mutex> lock(recorder.mutex_);
+    if ( recorder.fd_<0 ) return;
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    unsigned long long size=0, resident=0;
+    readstatm(size, resident);
+    unsigned long long rchar=0, wchar=0, readbytes=0, writebytes=0;
+    char buff[512];
+    if ( preadproc(procfd(proc_io), buff, sizeof(buff))>0 )
+    {
+	const char* const keys[]={ "rchar", "wchar", "read_bytes", "write_bytes" };
+	unsigned long long* const values[]={ &rchar, &wchar, &readbytes, &writebytes };
+	parseproc(buff, keys, values, 4, 1);
+    }
+    // One line with a single write, so that it is on disk even if the 
+    // program is killed:
+    char line[512];
+    const int n=std::snprintf(line, sizeof(line), "%.3f,%ld.%06ld,%ld.%06ld,%llu,%ld,%ld,%ld,%ld,%llu,%llu,%llu,%llu\n", (gettime_ns()-recorder.start_)*1.0e-9, (long)usage.ru_utime.tv_sec, (long)usage.ru_utime.tv_usec, (long)usage.ru_stime.tv_sec, (long)usage.ru_stime.tv_usec, resident, usage.ru_minflt, usage.ru_majflt, usage.ru_nvcsw, usage.ru_nivcsw, rchar, wchar, readbytes, writebytes);
+    if ( n>0 && ::write(recorder.fd_, line, std::min((std::size_t)n, sizeof(line)-1))<0 ) std::cerr<<"[config] Could not write metrics file!\n[config]\tvoid metrics_recorder::snapshot()\n";
 }
 
 
-config_entry::operator unsigned int() const
-{
-    if ( !success_ ) std::cerr<<"[config] Could not interpret entry \""<<string_<<"\" as unsigned int.\n[config]\tconfig_entry::operator unsigned int() const\n";
-    const unsigned int result=(unsigned int)longdouble_;
-    if ( (double)result!=longdouble_ ) std::cerr<<"[config] Problems while interpreting entry \""<<string_<<"\" as unsigned int.\n[config]\tconfig_entry::operator unsigned int() const\n";
-    return result;
-}
+static const bool metricsrecorderstarted=(std::getenv("METRICS_INTERVAL")!=0 && *std::getenv("METRICS_INTERVAL")!=0 ? (metrics_recorder::start(std::strtoul(std::getenv("METRICS_INTERVAL"), 0, 10)), true) : false);
 
 
-config_entry::operator bool() const
-{
-    if ( !success_ ) std::cerr<<"[config] Could not interpret entry \""<<string_<<"\" as bool.\n[config]\tconfig_entry::operator bool() const\n";
-    const bool result=(bool)longdouble_;
-    if ( (long double)result!=longdouble_ ) std::cerr<<"[config] Problems while interpreting entry \""<<string_<<"\" as bool.\n[config]\tconfig_entry::operator bool() const\n";
-    return result;
-}
+//////////////////// Implementation of class metrics_server ////////////
 
 
-config_entry::operator char() const
+metrics_counter::metrics_counter(const std::string &name, const std::string &help)
+ : name_(name), help_(help), value_(0)
 {
-    if ( string_.empty() ) return '\0';
-    if ( string_.length()>1 ) std::cerr<<"[config] String \""<<string_<<"\" consists of more than 1 characters.\n[config]\tconfig_entry::operator char() const\n";
-    return string_[0];
 }
 
 
-std::string config_entry::string() const
+unsigned long long metrics_counter::value() const
 {
-    return string_;
+    return value_.load(std::memory_order_relaxed);
 }
 
 
-long double config_entry::ldbl() const
+metrics_histogram::metrics_histogram(const std::string &name, const std::string &help, const std::vector<double> &bounds)
+ : name_(name), help_(help), bounds_(bounds), counts_(new std::atomic<unsigned long long>[bounds.size()+1]), sum_(0.0)
 {
-    return longdouble_;
+    for ( std::size_t i=0 ; i<=bounds_.size() ; ++i ) counts_[i]=0;
 }
 
 
-bool config_entry::success() const
+void metrics_histogram::observe(const double value)
 {
-    return success_;
+    const std::size_t bucket=std::lower_bound(bounds_.begin(), bounds_.end(), value)-bounds_.begin();
+    counts_[bucket].fetch_add(1, std::memory_order_relaxed);
+    double sum=sum_.load(std::memory_order_relaxed);
+    while ( !sum_.compare_exchange_weak(sum, sum+value, std::memory_order_relaxed) ) ;
 }
 
 
-const config_entry& config_entry::operator=(const config_entry &other)
+// State of the server (never destructed, so that it can be stopped 
+// from the destructor of __summaryinfo):
+struct metricsserver
 {
-    string_=other.string_;
-    longdouble_=other.longdouble_;
-    success_=other.success_;
-    return *this;
+    std::mutex control_;
+    std::mutex mutex_;
+    std::vector<metrics_counter*> counters_;
+    std::vector<metrics_histogram*> histograms_;
+    std::thread thread_;
+    int listenfd_;
+    int stopfd_;
+    std::string unixpath_;
+    metricsserver() : listenfd_(-1), stopfd_(-1) {}
+};
+
+
+static metricsserver& getmetricsserver()
+{
+    static metricsserver *server=new metricsserver();
+    return *server;
 }
 
 
-//////////////////// Implementation of class config ////////////////////
-
-config::config()
- : std::map< std::string, config_entry >()
+metrics_counter& metrics_server::counter(const std::string &name, const std::string &help)
 {
+    metricsserver &server=getmetricsserver();
+    std::lock_guard<std::mutex> lock(server.mutex_);
+    for ( std::size_t i=0 ; i<server.counters_.size() ; ++i ) if ( server.counters_[i]->name_==name ) return *server.counters_[i];
+    server.counters_.push_back(new metrics_counter(name, help));
+    return *server.counters_.back();
 }
 
 
-config::config(const config &other)
- : std::map< std::string, config_entry >(other)
+metrics_histogram& metrics_server::histogram(const std::string &name, const std::string &help, const std::vector<double> &bounds)
 {
+    metricsserver &server=getmetricsserver();
+    std::lock_guard<std::mutex> lock(server.mutex_);
+    for ( std::size_t i=0 ; i<server.histograms_.size() ; ++i ) if ( server.histograms_[i]->name_==name ) return *server.histograms_[i];
+    server.histograms_.push_back(new metrics_histogram(name, help, bounds));
+    return *server.histograms_.back();
 }
 
 
-config::~config()
+// Write a metric header:
+static void writemetric(std::ostream &out, const std::string &name, const std::string &help, const char *type)
 {
+    if ( !help.empty() ) out<<"# HELP "<<name<<" "<<help<<"\n";
+    out<<"# TYPE "<<name<<" "<<type<<"\n";
 }
 
 
-config& config::append(std::istream &file)
+void metrics_server::write(std::ostream &out)
 {
-    std::string linebuff;
-    std::istringstream iss;
-    std::string token, value_str, buff;
-    while ( std::getline(file, linebuff) )
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    unsigned long long size=0, resident=0;
+    readstatm(size, resident);
+    // The precision of the stream of the caller is restored at the end:
+    const std::streamsize precision=out.precision(15);
+    writemetric(out, "process_start_time_seconds", "Start time of the process since the Epoch", "gauge");
+    out<<"process_start_time_seconds "<<summaryinfo::starttime_<<"\n";
+    writemetric(out, "process_cpu_user_seconds_total", "User CPU time", "counter");
+    out<<"process_cpu_user_seconds_total "<<usage.ru_utime.tv_sec+usage.ru_utime.tv_usec*1.0e-6<<"\n";
+    writemetric(out, "process_cpu_system_seconds_total", "System CPU time", "counter");
+    out<<"process_cpu_system_seconds_total "<<usage.ru_stime.tv_sec+usage.ru_stime.tv_usec*1.0e-6<<"\n";
+    writemetric(out, "process_resident_memory_bytes", "Resident memory", "gauge");
+    out<<"process_resident_memory_bytes "<<resident<<"\n";
+    writemetric(out, "process_virtual_memory_bytes", "Virtual memory", "gauge");
+    out<<"process_virtual_memory_bytes "<<size<<"\n";
+    writemetric(out, "process_max_resident_memory_bytes", "Maximal resident memory", "gauge");
+    out<<"process_max_resident_memory_bytes "<<std::max(summaryinfo::maxresident_.load(), (unsigned long long)usage.ru_maxrss*1024)<<"\n";
+    metricsserver &server=getmetricsserver();
+    std::lock_guard<std::mutex> lock(server.mutex_);
+    for ( std::size_t i=0 ; i<server.counters_.size() ; ++i )
     {
-	if ( linebuff.length()==0 ) continue;
-	if ( linebuff[0]=='#' ) continue;
-	for ( unsigned int i=0 ; i<linebuff.length() ; ++i )
-	{
-	    if ( linebuff[i]=='=' ) linebuff.replace(i, 1, " ");
-	}
-	iss.str(linebuff);
-	if ( !(iss>>token) ) { iss.clear(); continue; }
-	if ( !(iss>>value_str) )
-	{
-	    std::cerr<<"[config] Could not extract config value from line:\n[config] "<<linebuff<<"\n[config]\nconfig& config::append(std::ifstream&)\n";
-	    iss.clear();
-	    continue;
-	}
-	if ( (iss>>buff) )
+	const metrics_counter &c=*server.counters_[i];
+	writemetric(out, c.name_, c.help_, "counter");
+	out<<c.name_<<" "<<c.value()<<"\n";
+    }
+    for ( std::size_t i=0 ; i<server.histograms_.size() ; ++i )
+    {
+	const metrics_histogram &h=*server.histograms_[i];
+	writemetric(out, h.name_, h.help_, "histogram");
+	unsigned long long count=0;
+	for ( std::size_t b=0 ; b<=h.bounds_.size() ; ++b )
 	{
-	    std::cerr<<"[config] An other entry is also present after config value in line:\n[config] "<<linebuff<<"\n[config]\tconfig& config::append(std::ifstream&)\n";
+	    count+=h.counts_[b].load(std::memory_order_relaxed);
+	    out<<h.name_<<"_bucket{le=\"";
+	    if ( b<h.bounds_.size() ) out<<h.bounds_[b];
+	    else out<<"+Inf";
+	    out<<"\"} "<<count<<"\n";
 	}
-	iss.clear();
-	(*this)[token]=config_entry(value_str);
+	out<<h.name_<<"_sum "<<h.sum_.load(std::memory_order_relaxed)<<"\n";
+	out<<h.name_<<"_count "<<count<<"\n";
     }
-    return *this;
+    out.precision(precision);
 }
 
 
-config& config::append(const std::string &filename)
+bool metrics_server::start(const std::string &address)
 {
-    std::istream *file=std::openin(filename);
-    if ( !(*file) )
+    metricsserver &server=getmetricsserver();
+    std::lock_guard<std::mutex> control(server.control_);
+    if ( server.thread_.joinable() ) return true;
+    if ( address.compare(0, 5, "unix:")==0 )
     {
-	std::cerr<<"[config] Could not open config file "<<filename<<" !\n[config]\nconfig& config::append(const std::string&)";
-	delete file;
-	return *this;
+	sockaddr_un addr;
+	std::memset(&addr, 0, sizeof(addr));
+	addr.sun_family=AF_UNIX;
+	const std::string path=address.substr(5);
+	if ( path.empty() || path.length()>=sizeof(addr.sun_path) )
+	{
+	    std::cerr<<"[config] Invalid metrics socket path "<<path<<" !\n[config]\tbool metrics_server::start(const std::string&)\n";
+	    return false;
+	}
+	std::strcpy(addr.sun_path, path.c_str());
+	::unlink(path.c_str());
+	server.listenfd_=::socket(AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC, 0);
+	if ( server.listenfd_<0 || ::bind(server.listenfd_, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr))!=0 ) goto failed;
+	server.unixpath_=path;
     }
-    append(*file);
-    delete file;
-    return *this;
+    else
+    {
+	sockaddr_in addr;
+	std::memset(&addr, 0, sizeof(addr));
+	addr.sin_family=AF_INET;
+	addr.sin_port=htons(std::strtoul(address.c_str(), 0, 10));
+	addr.sin_addr.s_addr=htonl(INADDR_LOOPBACK);
+	server.listenfd_=::socket(AF_INET, SOCK_STREAM|SOCK_CLOEXEC, 0);
+	const int one=1;
+	if ( server.listenfd_<0 || ::setsockopt(server.listenfd_, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one))!=0 || ::bind(server.listenfd_, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr))!=0 ) goto failed;
+    }
+    server.stopfd_=::eventfd(0, EFD_CLOEXEC);
+    if ( server.stopfd_<0 || ::listen(server.listenfd_, 16)!=0 ) goto failed;
+    server.thread_=std::thread(serve);
+    return true;
+ failed:
+    std::cerr<<"[config] Could not serve metrics on "<<address<<" : "<<std::strerror(errno)<<"\n[config]\tbool metrics_server::start(const std::string&)\n";
+    if ( server.listenfd_>=0 ) ::close(server.listenfd_);
+    if ( server.stopfd_>=0 ) ::close(server.stopfd_);
+    server.listenfd_=server.stopfd_=-1;
+    server.unixpath_.clear();
+    return false;
 }
 
 
-config::config(std::istream &file)
- : std::map< std::string, config_entry >()
+void metrics_server::stop()
 {
-    append(file);
+    metricsserver &server=getmetricsserver();
+    std::lock_guard<std::mutex> control(server.control_);
+    if ( !server.thread_.joinable() ) return;
+    const uint64_t one=1;
+    if ( ::write(server.stopfd_, &one, sizeof(one))!=sizeof(one) ) std::cerr<<"[config] Could not stop metrics server!\n[config]\tvoid metrics_server::stop()\n";
+    server.thread_.join();
+    ::close(server.listenfd_);
+    ::close(server.stopfd_);
+    server.listenfd_=server.stopfd_=-1;
+    if ( !server.unixpath_.empty() ) ::unlink(server.unixpath_.c_str());
+    server.unixpath_.clear();
 }
 
 
-config::config(const std::string &filename)
- : std::map< std::string, config_entry >()
-{
-    append(filename);
-}
+// Total time allowed to a client for one request and its response:
+static const unsigned long long metricsclient_timeout_ns=2000000000ULL;
 
 
-config& config::clear()
+// Wait until a (non-blocking) client socket is ready for the given 
+// events, the deadline passes or the server is stopped (1, 0, -1):
+static int waitclient(const int fd, const int stopfd, const short events, const unsigned long long deadline)
 {
-    std::map< std::string, config_entry >::clear();
-    return *this;
+    pollfd fds[2]={ { fd, events, 0 }, { stopfd, POLLIN, 0 } };
+    while ( true )
+    {
+	const unsigned long long now=gettime_ns();
+	if ( now>=deadline ) return 0;
+	const int ready=::poll(fds, 2, (int)((deadline-now+999999)/1000000));
+	if ( ready<0 && errno==EINTR ) continue;
+	if ( ready<0 ) return 0;
+	if ( fds[1].revents ) return -1;
+	if ( ready>0 ) return 1;
+    }
 }
 
 
-//////////////////// Implementation of getconfig functions /////////////
-
-
-config_entry getconfig(config &conf, const std::string &token)
+// Read a request and send the metrics to a client, until the deadline 
+// (false if the server was stopped meanwhile):
+static bool serveclient(const int fd, const int stopfd, const unsigned long long deadline)
 {
-    if ( conf[token].string_.empty() )
+    char request[4096];
+    std::size_t length=0;
+    while ( length<sizeof(request)-1 )
+    {
+	const ssize_t n=::recv(fd, request+length, sizeof(request)-1-length, 0);
+	if ( n==0 || (n<0 && errno!=EAGAIN && errno!=EWOULDBLOCK && errno!=EINTR) ) break;
+	if ( n>0 )
+	{
+	    length+=n;
+	    request[length]=0;
+	    if ( std::strstr(request, "\r\n\r\n")!=0 || std::strstr(request, "\n\n")!=0 ) break;
+	    continue;
+	}
+	const int ready=waitclient(fd, stopfd, POLLIN, deadline);
+	if ( ready<0 ) return false;
+	if ( ready==0 ) return true;
+    }
+    std::ostringstream body;
+    metrics_server::write(body);
+    std::ostringstream response;
+    response<<"HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: "<<body.str().length()<<"\r\nConnection: close\r\n\r\n"<<body.str();
+    const std::string data=response.str();
+    for ( std::size_t sent=0 ; sent<data.length() ; )
     {
-	std::cerr<<"[config] "<<token<<" is not specified in configfile!\n[config]\tconfig_entry getconfig(config&, const std::string&)\n";
+	const ssize_t n=::send(fd, data.data()+sent, data.length()-sent, MSG_NOSIGNAL);
+	if ( n>0 ) { sent+=n; continue; }
+	if ( n<0 && errno!=EAGAIN && errno!=EWOULDBLOCK && errno!=EINTR ) break;
+	const int ready=waitclient(fd, stopfd, POLLOUT, deadline);
+	if ( ready<0 ) return false;
+	if ( ready==0 ) break;
     }
-    return conf[token];
+    return true;
 }
 
 
-config_entry getconfig(std::istream &in, const std::string &token)
+void metrics_server::serve()
 {
-    config conf(in);
-    return getconfig(conf, token);
+    metricsserver &server=getmetricsserver();
+    profile_zone::threadname("metrics server");
+    pollfd fds[2]={ { server.listenfd_, POLLIN, 0 }, { server.stopfd_, POLLIN, 0 } };
+    while ( true )
+    {
+	if ( ::poll(fds, 2, -1)<0 )
+	{
+	    if ( errno==EINTR ) continue;
+	    std::cerr<<"[config] Polling metrics socket failed!\n[config]\tvoid metrics_server::serve()\n";
+	    return;
+	}
+	if ( fds[1].revents ) return;
+	const int fd=::accept4(server.listenfd_, 0, 0, SOCK_CLOEXEC|SOCK_NONBLOCK);
+	if ( fd<0 ) continue;
+	// Serve the client (read the request, whatever it is, and write 
+	// the response) within one deadline:
+	const bool stopped=!serveclient(fd, server.stopfd_, gettime_ns()+metricsclient_timeout_ns);
+	::close(fd);
+	if ( stopped ) return;
+    }
 }
 
 
-config_entry getconfig(const std::string &filename, const std::string &token)
-{
-    config conf(filename);
-    return getconfig(conf, token);
-}
+//////////////////// Implementation of class cpu_profile ///////////////
 
 
-//////////////////// Implementation of filenumbering function //////////
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
 
 
-std::string filenumbering(const unsigned int no, const unsigned int maxno)
+// A stack sample slot, written by the signal handler (state: 0 free, 
+// 1 being written, 2 ready):
+struct cpusample
 {
-    int ndigits=(no!=0 ? (int)(::log10((double)no))+1 : 1);
-    int ndigitsmax=(maxno!=0 ? (int)(::log10((double)maxno))+1 : 1);
-    std::ostringstream oss;
-    for ( int i=0 ; i<(int)ndigitsmax-(int)ndigits ; ++i ) oss<<"0";
-    oss<<no;
-    return oss.str();
+    static const unsigned int depth=48;
+    std::atomic<unsigned int> state_;
+    unsigned int n_;
+    void *frames_[depth];
+};
+
+
+// State of the profiler (never destructed, so that late signals and 
+// the destructor of __summaryinfo still find it):
+struct cpuprofiler
+{
+    static const std::size_t capacity=1<<13;
+    cpusample *samples_;
+    std::atomic<unsigned long long> next_;
+    std::atomic<unsigned long long> dropped_;
+    std::atomic<bool> running_;
+    unsigned int hz_;
+    std::mutex mutex_;
+    /// Timers of the profiled threads:
+    std::vector<std::pair<pid_t, timer_t> > timers_;
+    /// Aggregated stacks (leaf first):
+    std::map<std::vector<void*>, unsigned long long> stacks_;
+    periodicthread drainer_;
+    cpuprofiler() : samples_(0), next_(0), dropped_(0), running_(false), hz_(0) {}
+};
+
+
+static cpuprofiler& getcpuprofiler()
+{
+    static cpuprofiler *profiler=new cpuprofiler();
+    return *profiler;
 }
 
 
-//////////////////// Implementation of getrevision function ////////////
+// Stack bounds of a profiled thread, for the frame pointer walk of the 
+// signal handler (initial-exec TLS, so that reading them from a signal 
+// handler does not allocate):
+static thread_local std::uintptr_t cpustacklow __attribute__((tls_model("initial-exec")))=0;
+static thread_local std::uintptr_t cpustackhigh __attribute__((tls_model("initial-exec")))=0;
 
 
-#ifndef REVISIONSTRING
-#define REVISIONSTRING "unknown"
-#endif
-std::string getrevision()
+// Program counter and frame pointer of an interrupted context (false on 
+// architectures without a known frame layout):
+static bool contextframe(const void *context, std::uintptr_t &pc, std::uintptr_t &fp)
 {
-    return std::string(REVISIONSTRING);
+    const ucontext_t *uc=static_cast<const ucontext_t*>(context);
+#if defined(__x86_64__)
+    pc=uc->uc_mcontext.gregs[REG_RIP];
+    fp=uc->uc_mcontext.gregs[REG_RBP];
+    return true;
+#elif defined(__aarch64__)
+    pc=uc->uc_mcontext.pc;
+    fp=uc->uc_mcontext.regs[29];
+    return true;
+#else
+    (void)uc;
+    (void)pc;
+    (void)fp;
+    return false;
+#endif
 }
 
 
-//////////////////// Implementation of gettime function ////////////////
-
-
-unsigned int gettime()
+// Walk the frame pointer chain from an interrupted context. Every frame 
+// record is checked to lie within the stack of the thread, and to be 
+// above the previous one, before it is read, so that a frame pointer 
+// used as a general register (code compiled without 
+// -fno-omit-frame-pointer) ends the walk instead of faulting. Only 
+// reads memory, so it is async-signal-safe (unlike backtrace):
+static unsigned int walkframes(const void *context, void **frames, const unsigned int depth)
 {
-    time_t TIME;
-    time(&TIME);
-    return (unsigned int)TIME;
+    std::uintptr_t pc=0, fp=0;
+    if ( depth==0 || !contextframe(context, pc, fp) ) return 0;
+    unsigned int n=0;
+    frames[n++]=reinterpret_cast<void*>(pc);
+    while ( n<depth )
+    {
+	if ( fp<cpustacklow || fp+2*sizeof(void*)>cpustackhigh || fp%sizeof(void*)!=0 ) break;
+	void* const *record=reinterpret_cast<void* const*>(fp);
+	const std::uintptr_t next=reinterpret_cast<std::uintptr_t>(record[0]);
+	if ( record[1]==0 ) break;
+	frames[n++]=record[1];
+	if ( next<=fp ) break;
+	fp=next;
+    }
+    return n;
 }
 
 
-//////////////////// Implementation of gettime_hr function /////////////
+static void cpuprofilesignal(int, siginfo_t*, void *context)
+{
+    cpuprofiler &profiler=getcpuprofiler();
+    if ( !profiler.running_.load(std::memory_order_relaxed) ) return;
+    const int saved=errno;
+    cpusample &sample=profiler.samples_[profiler.next_.fetch_add(1, std::memory_order_relaxed)&(cpuprofiler::capacity-1)];
+    unsigned int free=0;
+    if ( !sample.state_.compare_exchange_strong(free, 1, std::memory_order_acquire) )
+    {
+	profiler.dropped_.fetch_add(1, std::memory_order_relaxed);
+	errno=saved;
+	return;
+    }
+    sample.n_=walkframes(context, sample.frames_, cpusample::depth);
+    sample.state_.store(sample.n_>0 ? 2 : 0, std::memory_order_release);
+    if ( sample.n_==0 ) profiler.dropped_.fetch_add(1, std::memory_order_relaxed);
+    errno=saved;
+}
 
 
-std::string gettime_hr()
+// Aggregate the ready samples:
+static void draincpuprofile()
 {
-    time_t TIME;
-    char chartime[32];
-    time(&TIME);
-    ctime_r(&TIME, chartime);
-    return std::string(chartime);
+    cpuprofiler &profiler=getcpuprofiler();
+    if ( profiler.samples_==0 ) return;
+    std::lock_guard<std::mutex> lock(profiler.mutex_);
+    for ( std::size_t i=0 ; i<cpuprofiler::capacity ; ++i )
+    {
+	cpusample &sample=profiler.samples_[i];
+	if ( sample.state_.load(std::memory_order_acquire)!=2 ) continue;
+	++profiler.stacks_[std::vector<void*>(sample.frames_, sample.frames_+sample.n_)];
+	sample.state_.store(0, std::memory_order_release);
+    }
 }
 
 
-//////////////////// Implementation of getusertime function ////////////
+// Timer of the calling thread, deleted when the thread exits:
+struct cputimer
+{
+    ~cputimer()
+    {
+	cpuprofiler &profiler=getcpuprofiler();
+	std::lock_guard<std::mutex> lock(profiler.mutex_);
+	const pid_t tid=syscall(SYS_gettid);
+	for ( std::size_t i=0 ; i<profiler.timers_.size() ; ++i )
+	{
+	    if ( profiler.timers_[i].first!=tid ) continue;
+	    timer_delete(profiler.timers_[i].second);
+	    profiler.timers_.erase(profiler.timers_.begin()+i);
+	    break;
+	}
+    }
+};
 
 
-unsigned int getusertime()
+// Check a profiling rate (Hz), warn if it is out of range:
+static bool validcpuprofilerate(const double hz, const char *signature)
 {
-    rusage usage;
-    getrusage(RUSAGE_SELF, &usage);
-    return usage.ru_utime.tv_sec;
+    if ( hz>=1 && hz<=cpu_profile::maxrate ) return true;
+    std::cerr<<"[config] CPU profiling rate "<<hz<<" Hz out of range (1 to "<<cpu_profile::maxrate<<" Hz), profiling not started!\n[config]\t"<<signature<<"\n";
+    return false;
 }
 
 
-//////////////////// Implementation of getcputime function /////////////
+// Start profiling with a rate read from a config key or the environment:
+static bool startcpuprofile(const double hz, const char *signature)
+{
+    return validcpuprofilerate(hz, signature) && cpu_profile::start((unsigned int)hz);
+}
 
 
-unsigned int getcputime()
+bool cpu_profile::start(const unsigned int hz)
 {
-    rusage usage;
-    getrusage(RUSAGE_SELF, &usage);
-    return usage.ru_stime.tv_sec;
+    if ( !validcpuprofilerate(hz, "bool cpu_profile::start(const unsigned int)") ) return false;
+    cpuprofiler &profiler=getcpuprofiler();
+    {
+	std::lock_guard<std::mutex> lock(profiler.mutex_);
+	if ( profiler.running_ ) return true;
+	if ( profiler.samples_==0 )
+	{
+	    profiler.samples_=new cpusample[cpuprofiler::capacity];
+	    for ( std::size_t i=0 ; i<cpuprofiler::capacity ; ++i ) profiler.samples_[i].state_=0;
+	}
+	struct sigaction action;
+	std::memset(&action, 0, sizeof(action));
+	action.sa_sigaction=cpuprofilesignal;
+	action.sa_flags=SA_SIGINFO|SA_RESTART;
+	sigemptyset(&action.sa_mask);
+	if ( sigaction(SIGPROF, &action, 0)!=0 )
+	{
+	    std::cerr<<"[config] Could not install profiling signal handler!\n[config]\tbool cpu_profile::start(const unsigned int)\n";
+	    return false;
+	}
+	profiler.hz_=hz;
+	profiler.running_=true;
+    }
+    startperiodic(profiler.drainer_, 1000, draincpuprofile);
+    return profilethread();
 }
 
 
-//////////////////// Implementation of getmem function ////////////////
+bool cpu_profile::start(const config &conf, const std::string &token)
+{
+    const config_entry *entry=conf.find(token);
+    if ( entry==0 || entry->empty() ) return false;
+    return startcpuprofile((double)*entry, "bool cpu_profile::start(const config&, const std::string&)");
+}
 
 
-unsigned int getmem()
+bool cpu_profile::profilethread()
 {
-    pid_t pid=getpid();
-    std::ostringstream str;
-    str<<"/proc/"<<pid<<"/stat";
-    std::ifstream file;
-    file.open(str.str().c_str());
-    std::string linebuff;
-    unsigned int i=0;
-    while ( std::getline(file, linebuff, ' ') )
+    cpuprofiler &profiler=getcpuprofiler();
+    static thread_local cputimer deleter;
+    (void)deleter;
+    std::lock_guard<std::mutex> lock(profiler.mutex_);
+    if ( !profiler.running_ ) return false;
+    if ( cpustackhigh==0 )
     {
-	++i;
-	if ( i>=23 ) break;
+	pthread_attr_t attr;
+	void *stack=0;
+	std::size_t size=0;
+	if ( pthread_getattr_np(pthread_self(), &attr)==0 )
+	{
+	    if ( pthread_attr_getstack(&attr, &stack, &size)==0 )
+	    {
+		cpustacklow=reinterpret_cast<std::uintptr_t>(stack);
+		cpustackhigh=cpustacklow+size;
+	    }
+	    pthread_attr_destroy(&attr);
+	}
     }
-    file.close();
-    file.clear();
-    std::istringstream iss(linebuff);
-    unsigned int mem=0;
-    if ( i<23 || !(iss>>mem) )
+    const pid_t tid=syscall(SYS_gettid);
+    for ( std::size_t i=0 ; i<profiler.timers_.size() ; ++i ) if ( profiler.timers_[i].first==tid ) return true;
+    sigevent event;
+    std::memset(&event, 0, sizeof(event));
+    event.sigev_notify=SIGEV_THREAD_ID;
+    event.sigev_signo=SIGPROF;
+    event.sigev_notify_thread_id=tid;
+    timer_t timer;
+    if ( timer_create(CLOCK_THREAD_CPUTIME_ID, &event, &timer)!=0 )
     {
-	std::cerr<<"[config] Could not get memory!\n[config]\tunsigned int getmem()\n";
-	return 0;
+	std::cerr<<"[config] Could not create profiling timer!\n[config]\tbool cpu_profile::profilethread()\n";
+	return false;
     }
-    return mem/1048576;
+    itimerspec interval;
+    interval.it_interval.tv_sec=0;
+    interval.it_interval.tv_nsec=std::max(1000000000/profiler.hz_, 1u);
+    if ( profiler.hz_==1 ) { interval.it_interval.tv_sec=1; interval.it_interval.tv_nsec=0; }
+    interval.it_value=interval.it_interval;
+    if ( timer_settime(timer, 0, &interval, 0)!=0 )
+    {
+	std::cerr<<"[config] Could not start profiling timer!\n[config]\tbool cpu_profile::profilethread()\n";
+	timer_delete(timer);
+	return false;
+    }
+    profiler.timers_.push_back(std::make_pair(tid, timer));
+    return true;
 }
 
 
-//////////////////// Implementation of putlogdata function /////////////
+void cpu_profile::stop()
+{
+    cpuprofiler &profiler=getcpuprofiler();
+    {
+	std::lock_guard<std::mutex> lock(profiler.mutex_);
+	if ( !profiler.running_ ) return;
+	for ( std::size_t i=0 ; i<profiler.timers_.size() ; ++i ) timer_delete(profiler.timers_[i].second);
+	profiler.timers_.clear();
+	profiler.running_=false;
+    }
+    startperiodic(profiler.drainer_, 0, std::function<void()>());
+    draincpuprofile();
+}
 
 
-void putlogdata(const std::string &filename)
+// Function name of a code address for folded stacks (without offset, 
+// [module] if unknown):
+static std::string foldedname(void *address)
 {
-    std::ostream *logfile=std::openout(filename);
-    if ( !(*logfile) )
+    std::string name=addressname(address);
+    const std::string::size_type open=name.find('('), bracket=name.rfind(" [");
+    if ( open!=std::string::npos && bracket!=std::string::npos )
     {
-	std::cerr<<"[config] Could not open logfile "<<filename<<" !\n[config]\tvoid putlogdata(const std::string&, const unsigned int)\n";
-	delete logfile;
-	return;
+	const std::string::size_type slash=name.rfind('/', open);
+	name="["+name.substr(slash==std::string::npos ? 0 : slash+1, open-(slash==std::string::npos ? 0 : slash+1))+"]";
     }
-    if ( !((*logfile)<<"Revision: "<<getrevision()<<"\n"<<"Started at: "<<summaryinfo::getstarttime_hr()<<"Running time: "<<getusertime()<<" seconds\n"<<"CPU time: "<<getcputime()<<" seconds\n"<<"Memory usage: "<<getmem()<<" MegaBytes\n"<<"Logged at: "<<gettime_hr()<<std::endl) )
+    else
     {
-	std::cerr<<"[config] Could not write into logfile "<<filename<<" !\n[config]\tvoid putlogdata(const std::string&, const unsigned int)\n";
-	delete logfile;
-	return;
+	const std::string::size_type plus=name.rfind("+0x");
+	if ( plus!=std::string::npos ) name.erase(plus);
     }
-    delete logfile;
+    std::replace(name.begin(), name.end(), ';', ':');
+    return name;
 }
 
 
-//////////////////// Implementation of class summaryinfo ///////////////
-
-
-#ifndef __NO_MEMORY_WATCHER
-static std::ipstream& mkauxmaxmemstream()
+void cpu_profile::write(std::ostream &out)
 {
-    pid_t pid=getpid();
-    if ( pid==0 )
+    draincpuprofile();
+    cpuprofiler &profiler=getcpuprofiler();
+    std::map<std::string, unsigned long long> folded;
     {
-	std::cerr<<"[config] Zero pid!\n[config]\tstatic std::ipstream& mkauxmaxmemstream()\n";
+	std::lock_guard<std::mutex> lock(profiler.mutex_);
+	std::map<void*, std::string> names;
+	for ( std::map<std::vector<void*>, unsigned long long>::const_iterator i=profiler.stacks_.begin() ; i!=profiler.stacks_.end() ; ++i )
+	{
+	    // Folded stacks are root first, separated by ';':
+	    std::string stack;
+	    for ( std::size_t f=i->first.size() ; f-->0 ; )
+	    {
+		std::map<void*, std::string>::iterator name=names.find(i->first[f]);
+		if ( name==names.end() ) name=names.insert(std::make_pair(i->first[f], foldedname(i->first[f]))).first;
+		stack+=name->second;
+		if ( f>0 ) stack+=";";
+	    }
+	    folded[stack]+=i->second;
+	}
     }
-    std::ostringstream strpid;
-    strpid<<pid;
-    std::ipstream *auxmaxmemstream=new std::ipstream(((const std::string)"while (( "+strpid.str()+" )) ; do sleep 1h ; done").c_str());
-    return *auxmaxmemstream;
+    for ( std::map<std::string, unsigned long long>::const_iterator i=folded.begin() ; i!=folded.end() ; ++i ) out<<i->first<<" "<<i->second<<"\n";
 }
 
 
-static std::ipstream& mkmaxmemstream()
+bool cpu_profile::writefile()
 {
-    pid_t pid=getpid();
-    std::ostringstream strpid;
-    strpid<<pid;
-    std::ipstream *maxmemstream=new std::ipstream(((const std::string)"__MEM=0 ; __MAXMEM=0 ; while ( ps aux | grep -v \"grep\" | grep \"while (( "+strpid.str()+" ))\" >&/dev/null ) ; do __MEM=`cat /proc/"+strpid.str()+"/stat 2>/dev/null | cut -f 23 -d ' '` ; if (( $__MEM > $__MAXMEM )) ; then __MAXMEM=$__MEM ; fi ; sleep 1s ; done ; echo \"$__MAXMEM\" ; unset __MEM ; unset __MAXMEM").c_str());
-    return *maxmemstream;
+    cpuprofiler &profiler=getcpuprofiler();
+    {
+	std::lock_guard<std::mutex> lock(profiler.mutex_);
+	if ( profiler.samples_==0 ) return true;
+    }
+    const std::string logfile=summaryinfo::logfilename();
+    const std::string filename=(logfile.empty() ? getresultsdir()+"/cpuprofile" : logfile)+".folded";
+    std::ofstream file(filename.c_str());
+    write(file);
+    if ( !file )
+    {
+	std::cerr<<"[config] Could not write CPU profile "<<filename<<" !\n[config]\tbool cpu_profile::writefile()\n";
+	return false;
+    }
+    if ( profiler.dropped_>0 ) std::cerr<<"[config] "<<profiler.dropped_<<" CPU profile samples dropped.\n";
+    return true;
 }
-#endif
 
 
+//////////////////// Implementation of class summaryinfo ///////////////
+
+
+// The memory watcher thread:
+static periodicthread& getmemorywatcher()
+{
+    static periodicthread *watcher=new periodicthread();
+    return *watcher;
+}
 
 
 const unsigned int summaryinfo::starttime_=gettime();
 
 const std::string summaryinfo::starttime_hr_=gettime_hr();
 
-unsigned int summaryinfo::maxmemory_=getmem();
+std::atomic<unsigned long long> summaryinfo::maxmemory_(0);
 
-#ifndef __NO_MEMORY_WATCHER
-std::ipstream& summaryinfo::auxmaxmemstream_=mkauxmaxmemstream();
-
-std::ipstream& summaryinfo::maxmemstream_=mkmaxmemstream();
-#endif
+std::atomic<unsigned long long> summaryinfo::maxresident_(0);
 
 std::ostream& summaryinfo::logfile_=std::cerr;
 
@@ -450,22 +4219,15 @@ summaryinfo::~summaryinfo()
 {
     if ( firstcopy_==true )
     {
+	watchmemory(0);
 	acquiremaxmem();
-#ifndef __NO_MEMORY_WATCHER
-	auxmaxmemstream_.kill();
-	auxmaxmemstream_.close();
-	auxmaxmemstream_.clear();
-	unsigned int membuff=0;
-	if ( !(maxmemstream_>>membuff) )
-	{
-	    std::cerr<<"[config] Could not read maximal memory stream!\n[config]\tsummaryinfo::~summaryinfo()\n";
-	    membuff=0;
-	}
-	maxmemstream_.close();
-	maxmemstream_.clear();
-	membuff/=1048576;
-	if ( membuff>maxmemory_ ) maxmemory_=membuff;
-#endif
+	metrics_recorder::snapshot();
+	metrics_recorder::stop();
+	metrics_server::stop();
+	alloc_profile::writereport();
+	cpu_profile::stop();
+	cpu_profile::writefile();
+	profile_zone::writetrace();
     }
     if ( firstcopy_==true && iswritten_==false && writelogfile_==true )
     {
@@ -479,7 +4241,7 @@ summaryinfo::~summaryinfo()
 		iswritten_=true;
 		return;
 	    }
-	    if ( !((*logfile)<<"Started at: "<<getstarttime_hr()<<"Running time: "<<getusertime()<<" seconds\n"<<"CPU time: "<<getcputime()<<" seconds\n"<<"Memory usage: "<<maxmemory_<<" MegaBytes\n"<<"Ended at: "<<gettime_hr()<<std::endl) )
+	    if ( !writesummary(*logfile) )
 	    {
 		std::cerr<<"[config] Could not write into logfile "<<logfilename_<<" !\n[config]\tsummaryinfo::~summaryinfo()\n";
 		delete logfile;
@@ -497,7 +4259,7 @@ summaryinfo::~summaryinfo()
 		iswritten_=true;
 		return;
 	    }
-	    if ( !(logfile_<<"Started at: "<<getstarttime_hr()<<"Running time: "<<getusertime()<<" seconds\n"<<"CPU time: "<<getcputime()<<" seconds\n"<<"Memory usage: "<<maxmemory_<<" MegaBytes\n"<<"Ended at: "<<gettime_hr()<<std::endl) )
+	    if ( !writesummary(logfile_) )
 	    {
 		std::cerr<<"[config] Could not write into logfile!\n[config]\tsummaryinfo::~summaryinfo()\n";
 		iswritten_=true;
@@ -509,6 +4271,22 @@ summaryinfo::~summaryinfo()
 }
 
 
+bool summaryinfo::writesummary(std::ostream &out)
+{
+    out<<"Started at: "<<getstarttime_hr()<<"Running time: "<<getusertime()<<" seconds\n"<<"CPU time: "<<getcputime()<<" seconds\n"<<"Memory usage: "<<showmaxmem()<<" MegaBytes\n"<<"Resident memory: "<<showmaxresident()<<" MegaBytes\n";
+    memory_stats stats;
+    if ( getmemstats(stats, memory_stats::smaps_rollup) ) out<<"Memory at end (bytes): resident "<<stats.resident_<<", anonymous "<<stats.anon_<<", file "<<stats.file_<<", shmem "<<stats.shmem_<<", swap "<<stats.swap_<<", huge pages "<<stats.hugepages_<<"\n";
+    out<<"Ended at: "<<gettime_hr()<<std::endl;
+    config_profile::report(out);
+    scoped_timer::report(out);
+    profile_zone::report(out);
+    perf_counters::report(out);
+    alloc_profile::report(out);
+    out<<std::flush;
+    return (bool)out;
+}
+
+
 const summaryinfo& summaryinfo::operator=(const summaryinfo &other)
 {
     return *this;
@@ -557,18 +4335,70 @@ std::string summaryinfo::getstarttime_hr()
 
 void summaryinfo::acquiremaxmem()
 {
-    unsigned int memory=getmem();
-    if ( maxmemory_<memory ) maxmemory_=memory;
+    unsigned long long size=0, resident=0;
+    if ( !readstatm(size, resident) ) return;
+    profile_zone::tracememory(size, resident);
+    unsigned long long max=maxmemory_.load(std::memory_order_relaxed);
+    while ( max<size && !maxmemory_.compare_exchange_weak(max, size, std::memory_order_relaxed) ) ;
+    max=maxresident_.load(std::memory_order_relaxed);
+    while ( max<resident && !maxresident_.compare_exchange_weak(max, resident, std::memory_order_relaxed) ) ;
 }
 
 
 unsigned int summaryinfo::showmaxmem()
 {
     acquiremaxmem();
-    return maxmemory_;
+    return maxmemory_/1048576;
+}
+
+
+unsigned int summaryinfo::showmaxvirtual()
+{
+    return showmaxmem();
+}
+
+
+unsigned int summaryinfo::showmaxresident()
+{
+    acquiremaxmem();
+    // The kernel also keeps the peak, catching the peaks between samples:
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    const unsigned long long maxrss=(unsigned long long)usage.ru_maxrss*1024;
+    return std::max(maxresident_.load(), maxrss)/1048576;
 }
 
 
+void summaryinfo::watchmemory(const unsigned int milliseconds)
+{
+    startperiodic(getmemorywatcher(), milliseconds, acquiremaxmem);
+}
+
+
+// The memory watcher is started by a MEMORY_WATCHER_INTERVAL environment 
+// variable, or by default (every 100 milliseconds) if 
+// __NO_MEMORY_WATCHER is not defined:
+static unsigned int memorywatcherinterval()
+{
+    const char *interval=std::getenv("MEMORY_WATCHER_INTERVAL");
+    if ( interval!=0 && *interval!=0 ) return std::strtoul(interval, 0, 10);
+#ifndef __NO_MEMORY_WATCHER
+    return 100;
+#else
+    return 0;
+#endif
+}
+
+
+static const bool memorywatcherstarted=(memorywatcherinterval()>0 ? (summaryinfo::watchmemory(memorywatcherinterval()), true) : false);
+
+
+static const bool metricsserverstarted=(std::getenv("METRICS_ENDPOINT")!=0 && *std::getenv("METRICS_ENDPOINT")!=0 ? metrics_server::start(std::getenv("METRICS_ENDPOINT")) : false);
+
+
+static const bool cpuprofilestarted=(std::getenv("CPU_PROFILE")!=0 && *std::getenv("CPU_PROFILE")!=0 ? startcpuprofile(std::strtod(std::getenv("CPU_PROFILE"), 0), "CPU_PROFILE environment variable") : false);
+
+
 #ifndef __NO_AUTO_LOGGING
 const summaryinfo __summaryinfo;
 #endif